@@ -0,0 +1,360 @@
+/*bench.cpp
+  Times each of the ways LAMMPSReader can read a dump file
+  Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+  This program contains no LAMMPS source code.
+  More LAMMPS information may be found at http://lammps.sandia.gov
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <lammpsreader.h>
+#include <lammpswriter.h>
+#include <parallelreader.h>
+
+using namespace LAMMPSReaderNS;
+
+//counts the atoms it is given, and sums a property so that nothing can be optimised away
+class Counter : public Callback {
+public:
+  int64_t frames;
+  int64_t atoms;
+  double sum;
+  Counter() : frames(0), atoms(0), sum(0.0) {}
+  void AtomLine(const AtomData& ad, LAMMPSReader*) {
+    atoms++;
+    sum+= ad.x;
+  }
+  void EndOfTimestep(LAMMPSReader*) {
+    frames++;
+  }
+};
+
+struct Result {
+  int64_t frames;
+  int64_t atoms;
+  double sum;
+};
+
+//what gendump wrote, given by -a and -f, which every path must read back; -1 if it isn't known
+static int64_t dump_atoms= -1;
+static int64_t dump_frames= -1;
+//the paths which failed, so that bench can exit with an error
+static int failures= 0;
+
+static void usage() {
+  std::cerr << "Usage: bench [-r repeats] [-p \"properties\"] [-t threads] [-a atoms -f frames] <text dump> <binary dump> \"binary columns\"" << std::endl;
+  std::cerr << "  -r  each path is run this many times, and the fastest is reported (default: 3)" << std::endl;
+  std::cerr << "  -p  the properties read (default: \"id x y z\"); x must be one of them" << std::endl;
+  std::cerr << "  -t  threads for the threaded paths (default: one per core)" << std::endl;
+  std::cerr << "  -a, -f  the atoms per frame and frames the dumps were written with, which each path is checked against" << std::endl;
+}
+
+static int64_t file_size(const std::string& filename) {
+  struct stat st;
+  return (stat(filename.c_str(), &st) == 0) ? st.st_size : 0;
+}
+
+//runs fn repeats times and prints the best time, as MB/s of the file and atoms/s
+//a path which fails, or reads a different number of frames or atoms from the ones written, isn't timed
+static void run(const std::string& name, const std::string& filename, int repeats, const std::function<bool(Result&)>& fn) {
+  double best= -1.0;
+  Result r;
+  for(int i= 0; i < repeats; i++) {
+    r.frames= 0;
+    r.atoms= 0;
+    r.sum= 0.0;
+    std::chrono::steady_clock::time_point start= std::chrono::steady_clock::now();
+    if(!fn(r)) {
+      std::cerr << name << " failed." << std::endl;
+      failures++;
+      return;
+    }
+    double t= std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(dump_frames >= 0 && (r.frames != dump_frames || r.atoms != dump_frames*dump_atoms)) {
+      std::cerr << name << " read " << r.frames << " frames and " << r.atoms << " atoms, but the dump holds "
+		<< dump_frames << " frames and " << dump_frames*dump_atoms << " atoms." << std::endl;
+      failures++;
+      return;
+    }
+    if(best < 0.0 || t < best) {
+      best= t;
+    }
+  }
+  double mb= file_size(filename)/1048576.0;
+  printf("%-34s %9.3f s %10.1f MB/s %14.0f atoms/s   (%lld atoms, checksum %.6g)\n",
+	 name.c_str(), best, mb/best, r.atoms/best, static_cast<long long>(r.atoms), r.sum);
+}
+
+static bool read_callbacks(LAMMPSReader& lr, const std::string& props, Result& r) {
+  Counter c;
+  while(lr.ReadFrame(props, &c)) {
+  }
+  r.frames= c.frames;
+  r.atoms= c.atoms;
+  r.sum= c.sum;
+  return true;
+}
+
+static bool read_frames(LAMMPSReader& lr, const std::string& props, Result& r) {
+  Frame f;
+  while(lr.ReadFrame(props, f)) {
+    r.frames++;
+    r.atoms+= f.size();
+    for(size_t i= 0; i < f.size(); i++) {
+      r.sum+= f.x[i];
+    }
+  }
+  return true;
+}
+
+//the fields are fixed at compile time, so this reads "id x y z" whatever -p says
+static bool read_records(LAMMPSReader& lr, Result& r) {
+  using namespace Fields;
+  int64_t atoms= 0;
+  double sum= 0.0;
+  while(lr.ReadFrame<id, x, y, z>([&](const Record<id, x, y, z>& a) {
+	atoms++;
+	sum+= a.x;
+      })) {
+    r.frames++;
+  }
+  r.atoms= atoms;
+  r.sum= sum;
+  return true;
+}
+
+//reads frames, and writes the properties read straight back out
+static bool copy_frames(LAMMPSReader& lr, const std::string& props, const std::string& out, bool bin, Result& r) {
+  LAMMPSWriter w;
+  if(!w.open(out, props, bin)) {
+    return false;
+  }
+  Frame f;
+  while(lr.ReadFrame(props, f)) {
+    if(!w.WriteFrame(f)) {
+      return false;
+    }
+    r.frames++;
+    r.atoms+= f.size();
+    for(size_t i= 0; i < f.size(); i++) {
+      r.sum+= f.x[i];
+    }
+  }
+  return w.close();
+}
+
+//reads the file as nshards shards at once, one thread and one reader per shard
+static bool read_shards(const std::string& filename, bool bin, const std::string& layout, const std::string& props,
+			int nshards, Result& r) {
+  std::vector<Result> results(nshards, Result());
+  std::vector<char> ok(nshards, 0);
+  std::vector<std::thread> workers;
+  for(int s= 0; s < nshards; s++) {
+    workers.push_back(std::thread([&, s]() {
+	  LAMMPSReader lr;
+	  int64_t begin, end;
+	  if(!lr.open(filename, bin, !bin)) {
+	    return;
+	  }
+	  if(bin) {
+	    lr.SetBinaryColumns(layout);
+	    //binary files are sharded by frame, using an index built here rather than one
+	    //saved next to the dump, which would make every repeat after the first cheaper
+	    if(!lr.BuildIndex(false)) {
+	      return;
+	    }
+	  }
+	  ok[s]= lr.ShardRange(nshards, s, begin, end) && lr.SetRange(begin, end) && read_frames(lr, props, results[s]);
+	}));
+  }
+  bool good= true;
+  for(int s= 0; s < nshards; s++) {
+    workers[s].join();
+    good= good && ok[s];
+    r.frames+= results[s].frames;
+    r.atoms+= results[s].atoms;
+    r.sum+= results[s].sum;
+  }
+  return good;
+}
+
+//walks the frame headers, as SkipFrames() does, without keeping a sidecar index
+static bool index_frames(LAMMPSReader& lr, Result& r) {
+  if(!lr.BuildIndex(false)) {
+    return false;
+  }
+  r.frames= lr.Index().size();
+  for(size_t i= 0; i < lr.Index().size(); i++) {
+    r.atoms+= lr.Index()[i].n_atoms;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int repeats= 3;
+  int threads= std::thread::hardware_concurrency();
+  std::string props= "id x y z";
+  int arg= 1;
+  while(arg + 1 < argc && argv[arg][0] == '-') {
+    if(strcmp(argv[arg], "-r") == 0) {
+      repeats= atoi(argv[arg+1]);
+    } else if(strcmp(argv[arg], "-p") == 0) {
+      props= argv[arg+1];
+    } else if(strcmp(argv[arg], "-t") == 0) {
+      threads= atoi(argv[arg+1]);
+    } else if(strcmp(argv[arg], "-a") == 0) {
+      dump_atoms= atoll(argv[arg+1]);
+    } else if(strcmp(argv[arg], "-f") == 0) {
+      dump_frames= atoll(argv[arg+1]);
+    } else {
+      usage();
+      return 1;
+    }
+    arg+= 2;
+  }
+  if(argc - arg != 3 || repeats < 1 || (dump_atoms < 0) != (dump_frames < 0)) {
+    usage();
+    return 1;
+  }
+  if(threads < 1) {
+    threads= 1;
+  }
+  std::string text= argv[arg];
+  std::string bin= argv[arg+1];
+  std::string layout= argv[arg+2];
+
+  printf("text dump %s (%.1f MB), binary dump %s (%.1f MB), reading \"%s\", best of %d, %d threads\n",
+	 text.c_str(), file_size(text)/1048576.0, bin.c_str(), file_size(bin)/1048576.0, props.c_str(), repeats, threads);
+
+  run("text, callbacks", text, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    return lr.open(text) && read_callbacks(lr, props, r);
+  });
+  run("text, frames", text, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    return lr.open(text) && read_frames(lr, props, r);
+  });
+  run("text, frames, prefetch", text, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    return lr.open(text) && lr.EnablePrefetch() && read_frames(lr, props, r);
+  });
+  run("text, headers only (indexing)", text, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    return lr.open(text) && index_frames(lr, r);
+  });
+  run("mapped text, callbacks", text, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    return lr.open(text, false, true) && read_callbacks(lr, props, r);
+  });
+  run("mapped text, ReadFrame<id,x,y,z>", text, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    return lr.open(text, false, true) && read_records(lr, r);
+  });
+  run("mapped text, frames", text, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    return lr.open(text, false, true) && read_frames(lr, props, r);
+  });
+  run("mapped text, frames, threads", text, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    lr.threads= threads;
+    return lr.open(text, false, true) && read_frames(lr, props, r);
+  });
+  run("mapped text, ParallelReader", text, repeats, [&](Result& r) {
+    ParallelReader pr(threads);
+    if(!pr.open(text, false, true)) {
+      return false;
+    }
+    Frame f;
+    while(pr.ReadFrame(props, f)) {
+      r.frames++;
+      r.atoms+= f.size();
+      for(size_t i= 0; i < f.size(); i++) {
+	r.sum+= f.x[i];
+      }
+    }
+    return !pr.error();
+  });
+  run("mapped text, frames, shards", text, repeats, [&](Result& r) {
+    return read_shards(text, false, layout, props, threads, r);
+  });
+  run("binary, callbacks", bin, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    if(!lr.open(bin, true)) {
+      return false;
+    }
+    lr.SetBinaryColumns(layout);
+    return read_callbacks(lr, props, r);
+  });
+  run("binary, ReadFrame<id,x,y,z>", bin, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    if(!lr.open(bin, true)) {
+      return false;
+    }
+    lr.SetBinaryColumns(layout);
+    return read_records(lr, r);
+  });
+  run("binary, frames", bin, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    if(!lr.open(bin, true)) {
+      return false;
+    }
+    lr.SetBinaryColumns(layout);
+    return read_frames(lr, props, r);
+  });
+  run("binary, frames, threads", bin, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    lr.threads= threads;
+    if(!lr.open(bin, true)) {
+      return false;
+    }
+    lr.SetBinaryColumns(layout);
+    return read_frames(lr, props, r);
+  });
+  run("binary, frames, shards", bin, repeats, [&](Result& r) {
+    return read_shards(bin, true, layout, props, threads, r);
+  });
+  run("binary, headers only (indexing)", bin, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    return lr.open(bin, true) && index_frames(lr, r);
+  });
+  //the copies are written next to the text dump, and removed afterwards
+  std::string copy= text + ".copy";
+  run("mapped text, frames, written as text", text, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    return lr.open(text, false, true) && copy_frames(lr, props, copy, false, r);
+  });
+  run("binary, frames, written as binary", bin, repeats, [&](Result& r) {
+    LAMMPSReader lr;
+    if(!lr.open(bin, true)) {
+      return false;
+    }
+    lr.SetBinaryColumns(layout);
+    return copy_frames(lr, props, copy, true, r);
+  });
+  remove(copy.c_str());
+  return failures ? 1 : 0;
+}
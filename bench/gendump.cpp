@@ -0,0 +1,173 @@
+/*gendump.cpp
+  Writes synthetic LAMMPS dump files, text or binary, for benchmarking LAMMPSReader
+  Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+  This program contains no LAMMPS source code.
+  More LAMMPS information may be found at http://lammps.sandia.gov
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <lammpsreader.h>
+
+using namespace LAMMPSReaderNS;
+
+static void usage() {
+  std::cerr << "Usage: gendump [-b] [-a atoms] [-f frames] [-p procs] [-c \"columns\"] [-s seed] <output file>" << std::endl;
+  std::cerr << "  -b  write a binary dump (default: text)" << std::endl;
+  std::cerr << "  -a  atoms per frame (default: 100000)" << std::endl;
+  std::cerr << "  -f  frames (default: 10)" << std::endl;
+  std::cerr << "  -p  processor blocks per frame, for binary dumps (default: 4)" << std::endl;
+  std::cerr << "  -c  columns (default: \"id type x y z vx vy vz\")" << std::endl;
+  std::cerr << "  -s  random seed (default: 1), so that runs can be repeated exactly" << std::endl;
+}
+
+//the value of one column for one atom; ids are a shuffle of 1 to n, as LAMMPS writes them
+static double value(const std::string& col, int id, double box, std::mt19937& rng) {
+  std::uniform_real_distribution<double> in_box(0.0, box);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::normal_distribution<double> gauss(0.0, 1.0);
+  if(col == "id") {
+    return id;
+  } else if(col == "type") {
+    return 1 + id % 3;
+  } else if(col == "mol") {
+    return 1 + id / 100;
+  } else if(col == "ix" || col == "iy" || col == "iz") {
+    return static_cast<int>(gauss(rng));
+  } else if(col == "x" || col == "y" || col == "z" || col == "xu" || col == "yu" || col == "zu") {
+    //a few atoms just outside the box, so that wrapping has something to do
+    return in_box(rng)*1.02 - 0.01*box;
+  } else if(col == "xs" || col == "ys" || col == "zs" || col == "xsu" || col == "ysu" || col == "zsu") {
+    return unit(rng);
+  } else if(col == "mass") {
+    return 1.0;
+  }
+  return gauss(rng);
+}
+
+static bool is_int(const std::string& col) {
+  return col == "id" || col == "type" || col == "mol" || col == "ix" || col == "iy" || col == "iz";
+}
+
+int main(int argc, char **argv) {
+  bool binary= false;
+  int64_t natoms= 100000;
+  int nframes= 10;
+  int nprocs= 4;
+  std::string columns= "id type x y z vx vy vz";
+  unsigned int seed= 1;
+  int arg= 1;
+  while(arg + 1 < argc && argv[arg][0] == '-') {
+    std::string opt= argv[arg];
+    if(opt == "-b") {
+      binary= true;
+      arg++;
+      continue;
+    }
+    if(opt == "-a") {
+      natoms= atoll(argv[arg+1]);
+    } else if(opt == "-f") {
+      nframes= atoi(argv[arg+1]);
+    } else if(opt == "-p") {
+      nprocs= atoi(argv[arg+1]);
+    } else if(opt == "-c") {
+      columns= argv[arg+1];
+    } else if(opt == "-s") {
+      seed= atoi(argv[arg+1]);
+    } else {
+      usage();
+      return 1;
+    }
+    arg+= 2;
+  }
+  if(arg != argc - 1 || natoms < 0 || nframes < 0 || nprocs < 1) {
+    usage();
+    return 1;
+  }
+  std::vector<std::string> cols= explode(columns);
+  FILE *out= fopen(argv[arg], "wb");
+  if(!out) {
+    std::cerr << "Error! Failed to open file " << argv[arg] << " for writing." << std::endl;
+    return 1;
+  }
+
+  std::mt19937 rng(seed);
+  const double box= 100.0;
+  std::vector<int> ids(natoms);
+  std::vector<double> row(cols.size());
+  for(int t= 0; t < nframes; t++) {
+    int64_t timestep= static_cast<int64_t>(t)*1000;
+    for(int64_t i= 0; i < natoms; i++) {
+      ids[i]= i + 1;
+    }
+    std::shuffle(ids.begin(), ids.end(), rng);
+    if(binary) {
+      //the layout is described in the LAMMPSReader README
+      int triclinic= 0;
+      int boundary[6]= {0, 0, 0, 0, 1, 1};
+      double bounds[6]= {0.0, box, 0.0, box, 0.0, box};
+      int size_one= cols.size();
+      fwrite(&timestep, sizeof(timestep), 1, out);
+      fwrite(&natoms, sizeof(natoms), 1, out);
+      fwrite(&triclinic, sizeof(triclinic), 1, out);
+      fwrite(boundary, sizeof(boundary), 1, out);
+      fwrite(bounds, sizeof(bounds), 1, out);
+      fwrite(&size_one, sizeof(size_one), 1, out);
+      fwrite(&nprocs, sizeof(nprocs), 1, out);
+      int64_t per= (natoms + nprocs - 1) / nprocs;
+      for(int p= 0; p < nprocs; p++) {
+	int64_t first= std::min(natoms, p*per);
+	int64_t last= std::min(natoms, first + per);
+	int bufsize= (last - first)*size_one;
+	fwrite(&bufsize, sizeof(bufsize), 1, out);
+	for(int64_t i= first; i < last; i++) {
+	  for(size_t c= 0; c < cols.size(); c++) {
+	    row[c]= value(cols[c], ids[i], box, rng);
+	  }
+	  fwrite(&row[0], sizeof(double), row.size(), out);
+	}
+      }
+    } else {
+      fprintf(out, "ITEM: TIMESTEP\n%lld\nITEM: NUMBER OF ATOMS\n%lld\n", static_cast<long long>(timestep), static_cast<long long>(natoms));
+      fprintf(out, "ITEM: BOX BOUNDS pp pp ff\n0 %g\n0 %g\n0 %g\nITEM: ATOMS %s\n", box, box, box, columns.c_str());
+      for(int64_t i= 0; i < natoms; i++) {
+	for(size_t c= 0; c < cols.size(); c++) {
+	  double v= value(cols[c], ids[i], box, rng);
+	  if(is_int(cols[c])) {
+	    fprintf(out, c ? " %d" : "%d", static_cast<int>(v));
+	  } else {
+	    fprintf(out, c ? " %g" : "%g", v);
+	  }
+	}
+	fputc('\n', out);
+      }
+    }
+  }
+  if(fclose(out) != 0) {
+    std::cerr << "Error! Failed to write " << argv[arg] << std::endl;
+    return 1;
+  }
+  return 0;
+}
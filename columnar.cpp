@@ -0,0 +1,344 @@
+/*
+    columnar.cpp
+    A column-by-column trajectory container, for trajectories which are analysed many times
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "columnar.h"
+
+namespace LAMMPSReaderNS {
+
+  //the file starts with header_magic, padded to block_align bytes,
+  //and ends with the offset of the footer followed by footer_magic
+  static const char header_magic[8]= {'L', 'R', 'C', 'O', 'L', '0', '0', '1'};
+  static const char footer_magic[8]= {'L', 'R', 'C', 'O', 'L', 'E', 'N', 'D'};
+  static const size_t block_align= 64;
+  static const size_t name_length= 16;
+
+  ColumnarWriter::ColumnarWriter() {
+    pos= 0;
+  }
+
+  ColumnarWriter::~ColumnarWriter() {
+    close();
+  }
+
+  bool ColumnarWriter::open(const std::string& filename, const std::string& columns) {
+    close();
+    names= explode(columns);
+    icols.clear();
+    dcols.clear();
+    frames.clear();
+    offsets.clear();
+    if(names.empty()) {
+      std::cerr << "ERROR: ColumnarWriter::open() needs at least one column. (" << filename << ")" << std::endl;
+      return false;
+    }
+    for(std::vector<std::string>::const_iterator it= names.begin(); it < names.end(); it++) {
+      const PropertySlot *slot= FindProperty(*it);
+      if(!slot) {
+	std::cerr << "ERROR: ColumnarWriter doesn't know the property '" << *it << "'. (" << filename << ")" << std::endl;
+	return false;
+      }
+      icols.push_back(slot->icol);
+      dcols.push_back(slot->dcol);
+    }
+    out.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if(!out.is_open()) {
+      std::cerr << "Error! Failed to open file " << filename << " for writing." << std::endl;
+      return false;
+    }
+    curfile= filename;
+    pos= 0;
+    write(header_magic, sizeof(header_magic));
+    align();
+    return !out.fail();
+  }
+
+  void ColumnarWriter::write(const void *p, size_t n) {
+    out.write(static_cast<const char*>(p), n);
+    pos+= n;
+  }
+
+  void ColumnarWriter::align() {
+    static const char zeros[block_align]= {0};
+    if(pos % block_align != 0) {
+      write(zeros, block_align - pos % block_align);
+    }
+  }
+
+  bool ColumnarWriter::WriteFrame(const Frame& f) {
+    if(!out.is_open()) {
+      std::cerr << "ColumnarWriter::WriteFrame() called while no file is open." << std::endl;
+      return false;
+    }
+    size_t n= f.size();
+    for(size_t c= 0; c < names.size(); c++) {
+      size_t have= icols[c] ? (f.*icols[c]).size() : (f.*dcols[c]).size();
+      if(have != n) {
+	std::cerr << "ERROR: Timestep " << f.timestep << " was written without its '" << names[c] << "' column. (" << curfile << ")" << std::endl;
+	return false;
+      }
+    }
+    FrameInfo fi;
+    fi.offset= pos;
+    fi.timestep= f.timestep;
+    fi.n_atoms= n;
+    memcpy(fi.boundaries, f.boundaries, sizeof(fi.boundaries));
+    for(int i= 0; i < 3; i++) {
+      fi.box_lo[i]= f.box_lo[i];
+      fi.box_hi[i]= f.box_hi[i];
+    }
+    frames.push_back(fi);
+    for(size_t c= 0; c < names.size(); c++) {
+      offsets.push_back(pos);
+      if(n == 0) {
+	continue;
+      }
+      if(icols[c]) {
+	write(&(f.*icols[c])[0], n*sizeof(int));
+      } else {
+	write(&(f.*dcols[c])[0], n*sizeof(double));
+      }
+      align();
+    }
+    if(out.fail()) {
+      std::cerr << "ERROR: Failed to write timestep " << f.timestep << " to " << curfile << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool ColumnarWriter::close() {
+    if(!out.is_open()) {
+      return true;
+    }
+    //the footer: the columns, then each frame's header and block offsets
+    int64_t footer= pos;
+    int64_t ncols= names.size();
+    write(&ncols, sizeof(ncols));
+    for(size_t c= 0; c < names.size(); c++) {
+      char name[name_length];
+      memset(name, 0, sizeof(name));
+      strncpy(name, names[c].c_str(), sizeof(name) - 1);
+      int32_t is_int= icols[c] ? 1 : 0;
+      write(name, sizeof(name));
+      write(&is_int, sizeof(is_int));
+    }
+    int64_t nframes= frames.size();
+    write(&nframes, sizeof(nframes));
+    for(size_t i= 0; i < frames.size(); i++) {
+      const FrameInfo& fi= frames[i];
+      write(&fi.timestep, sizeof(fi.timestep));
+      write(&fi.n_atoms, sizeof(fi.n_atoms));
+      write(&fi.boundaries[0][0], sizeof(fi.boundaries));
+      write(fi.box_lo, sizeof(fi.box_lo));
+      write(fi.box_hi, sizeof(fi.box_hi));
+      write(&offsets[i*names.size()], names.size()*sizeof(int64_t));
+    }
+    write(&footer, sizeof(footer));
+    write(footer_magic, sizeof(footer_magic));
+    bool ok= !out.fail();
+    out.close();
+    if(!ok) {
+      std::cerr << "ERROR: Failed to finish writing " << curfile << std::endl;
+    }
+    curfile= "";
+    return ok;
+  }
+
+  ColumnarReader::ColumnarReader() {
+    map_begin= NULL;
+    map_size= 0;
+  }
+
+  ColumnarReader::~ColumnarReader() {
+    close();
+  }
+
+  void ColumnarReader::close() {
+    if(map_begin) {
+      munmap(const_cast<char*>(map_begin), map_size);
+    }
+    map_begin= NULL;
+    map_size= 0;
+    names.clear();
+    is_int.clear();
+    frames.clear();
+    offsets.clear();
+    curfile= "";
+  }
+
+  bool ColumnarReader::open(const std::string& filename) {
+    close();
+    struct stat st;
+    if(stat(filename.c_str(), &st) != 0) {
+      std::cerr << "Error! Failed to open file " << filename << std::endl;
+      return false;
+    }
+    size_t size= st.st_size;
+    if(size < block_align + sizeof(int64_t) + sizeof(footer_magic)) {
+      std::cerr << "ERROR: " << filename << " is too short to be a columnar trajectory." << std::endl;
+      return false;
+    }
+    int fd= ::open(filename.c_str(), O_RDONLY);
+    void *addr= (fd < 0) ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(fd >= 0) {
+      ::close(fd);
+    }
+    if(addr == MAP_FAILED) {
+      std::cerr << "Error! Failed to memory map file " << filename << std::endl;
+      return false;
+    }
+    map_begin= static_cast<const char*>(addr);
+    map_size= size;
+    curfile= filename;
+
+    //the footer is read with a cursor that refuses to run past the end of the file
+    const char *end= map_begin + map_size - sizeof(footer_magic) - sizeof(int64_t);
+    int64_t footer;
+    memcpy(&footer, end, sizeof(footer));
+    if(memcmp(map_begin, header_magic, sizeof(header_magic)) != 0 || memcmp(end + sizeof(footer), footer_magic, sizeof(footer_magic)) != 0 ||
+       footer < static_cast<int64_t>(block_align) || footer > end - map_begin) {
+      std::cerr << "ERROR: " << filename << " isn't a columnar trajectory, or wasn't finished." << std::endl;
+      close();
+      return false;
+    }
+    const char *p= map_begin + footer;
+    bool ok= true;
+    #define Take(dst, n) if(ok && p + (n) <= end) { memcpy((dst), p, (n)); p+= (n); } else { ok= false; }
+    int64_t ncols= 0, nframes= 0;
+    Take(&ncols, sizeof(ncols));
+    ok= ok && ncols >= 0 && ncols < 1024;
+    for(int64_t c= 0; ok && c < ncols; c++) {
+      char name[name_length + 1];
+      int32_t flag= 0;
+      Take(name, name_length);
+      Take(&flag, sizeof(flag));
+      name[name_length]= '\0';
+      names.push_back(name);
+      is_int.push_back(flag);
+    }
+    Take(&nframes, sizeof(nframes));
+    for(int64_t i= 0; ok && i < nframes; i++) {
+      FrameInfo fi;
+      Take(&fi.timestep, sizeof(fi.timestep));
+      Take(&fi.n_atoms, sizeof(fi.n_atoms));
+      Take(&fi.boundaries[0][0], sizeof(fi.boundaries));
+      Take(fi.box_lo, sizeof(fi.box_lo));
+      Take(fi.box_hi, sizeof(fi.box_hi));
+      size_t first= offsets.size();
+      offsets.resize(first + ncols);
+      if(ncols > 0) {
+	Take(&offsets[first], ncols*sizeof(int64_t));
+      }
+      //every block has to lie before the footer
+      for(int64_t c= 0; ok && c < ncols; c++) {
+	int64_t len= fi.n_atoms*(is_int[c] ? sizeof(int) : sizeof(double));
+	ok= fi.n_atoms >= 0 && offsets[first + c] >= 0 && offsets[first + c] + len <= footer;
+      }
+      fi.offset= ncols > 0 ? offsets[first] : footer;
+      frames.push_back(fi);
+    }
+    #undef Take
+    if(!ok) {
+      std::cerr << "ERROR: The frame directory of " << filename << " is damaged." << std::endl;
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  const char* ColumnarReader::block(size_t frame, const std::string& name, bool want_int) const {
+    if(frame >= frames.size()) {
+      return NULL;
+    }
+    for(size_t c= 0; c < names.size(); c++) {
+      if(names[c] == name && (is_int[c] != 0) == want_int) {
+	return map_begin + offsets[frame*names.size() + c];
+      }
+    }
+    return NULL;
+  }
+
+  const int* ColumnarReader::IntColumn(size_t frame, const std::string& name) const {
+    return reinterpret_cast<const int*>(block(frame, name, true));
+  }
+
+  const double* ColumnarReader::DoubleColumn(size_t frame, const std::string& name) const {
+    return reinterpret_cast<const double*>(block(frame, name, false));
+  }
+
+  bool ColumnarReader::ReadFrame(size_t frame, Frame& f, const std::string& properties) const {
+    if(frame >= frames.size()) {
+      std::cerr << "ERROR: Frame " << frame << " was requested, but " << curfile << " only contains " << frames.size() << " frames." << std::endl;
+      return false;
+    }
+    std::vector<std::string> wanted= properties.empty() ? names : explode(properties);
+    const FrameInfo& fi= frames[frame];
+    size_t n= fi.n_atoms;
+    //as with LAMMPSReader, the arrays which aren't wanted are emptied
+    for(size_t i= 0; i < n_property_slots; i++) {
+      const PropertySlot& slot= property_slots[i];
+      if(std::find(wanted.begin(), wanted.end(), slot.name) != wanted.end()) {
+	continue;
+      }
+      if(slot.icol) {
+	std::vector<int>().swap(f.*slot.icol);
+      } else {
+	std::vector<double>().swap(f.*slot.dcol);
+      }
+    }
+    for(std::vector<std::string>::const_iterator it= wanted.begin(); it < wanted.end(); it++) {
+      const PropertySlot *slot= FindProperty(*it);
+      const char *src= slot ? block(frame, *it, slot->icol != NULL) : NULL;
+      if(!src) {
+	std::cerr << "ERROR: '" << *it << "' was requested, but it isn't one of the columns in " << curfile << std::endl;
+	return false;
+      }
+      if(slot->icol) {
+	const int *b= reinterpret_cast<const int*>(src);
+	(f.*slot->icol).assign(b, b + n);
+      } else {
+	const double *b= reinterpret_cast<const double*>(src);
+	(f.*slot->dcol).assign(b, b + n);
+      }
+    }
+    f.timestep= fi.timestep;
+    f.n_atoms= fi.n_atoms;
+    f.n_rows= -1;
+    memcpy(f.boundaries, fi.boundaries, sizeof(f.boundaries));
+    for(int i= 0; i < 3; i++) {
+      f.box_lo[i]= fi.box_lo[i];
+      f.box_hi[i]= fi.box_hi[i];
+    }
+    return true;
+  }
+}
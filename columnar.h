@@ -0,0 +1,97 @@
+/*
+    columnar.h
+    A column-by-column trajectory container, for trajectories which are analysed many times
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "lammpsreader.h"
+
+namespace LAMMPSReaderNS {
+
+  //a columnar file holds, for every frame, one block per column: n_atoms int32s or
+  //doubles, in the byte order of the machine that wrote it, starting on a 64 byte boundary
+  //a footer lists the columns, and the header of every frame along with where its blocks are
+
+  class ColumnarWriter {
+  public:
+    ColumnarWriter();
+    ~ColumnarWriter();
+
+    //columns are property names, as for ReadFrame(), e.g. "id type x y z"
+    bool open(const std::string& filename, const std::string& columns);
+    //every frame written must have all of the columns filled in
+    bool WriteFrame(const Frame&);
+    //writes the footer; until then, the file can't be read
+    bool close();
+  private:
+    std::ofstream out;
+    std::string curfile;
+    std::vector<std::string> names;
+    std::vector<std::vector<int> Frame::*> icols;
+    std::vector<std::vector<double> Frame::*> dcols;
+    std::vector<FrameInfo> frames;
+    //offsets of the blocks, one per column for each frame
+    std::vector<int64_t> offsets;
+    int64_t pos;
+    void write(const void*, size_t);
+    void align();
+  };
+
+  class ColumnarReader {
+  public:
+    ColumnarReader();
+    ~ColumnarReader();
+
+    //the file is memory mapped, and its columns are used where they lie
+    bool open(const std::string&);
+    void close();
+
+    size_t Frames() const { return frames.size(); }
+    //the header of a frame; offset is where its first block starts
+    const FrameInfo& Info(size_t frame) const { return frames[frame]; }
+    const std::vector<std::string>& Columns() const { return names; }
+
+    //pointers straight into the mapping, with Info(frame).n_atoms values,
+    //or NULL if there's no such column of that type
+    const int* IntColumn(size_t frame, const std::string& name) const;
+    const double* DoubleColumn(size_t frame, const std::string& name) const;
+
+    //copies the given properties of a frame (all of them, if none are given) into f
+    bool ReadFrame(size_t frame, Frame& f, const std::string& properties= "") const;
+  private:
+    std::string curfile;
+    const char *map_begin;
+    size_t map_size;
+    std::vector<std::string> names;
+    std::vector<int> is_int;
+    std::vector<FrameInfo> frames;
+    std::vector<int64_t> offsets;
+    const char* block(size_t frame, const std::string& name, bool want_int) const;
+  };
+}
+
+#endif
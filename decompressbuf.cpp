@@ -0,0 +1,453 @@
+/*
+    decompressbuf.cpp
+    Seekable stream buffers for reading gzip and zstd compressed dump files
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "decompressbuf.h"
+
+namespace LAMMPSReaderNS {
+
+  //the decompressed data is produced this much at a time
+  static const size_t out_chunk= 1 << 20;
+  //and the compressed data is read this much at a time
+  static const size_t in_chunk= 1 << 18;
+
+  const size_t DecompressBuf::history_size;
+
+  DecompressBuf::DecompressBuf(std::streambuf *source, int64_t s) {
+    src= source;
+    span= s;
+    failed= false;
+    buf.resize(history_size + out_chunk);
+    hist_len= 0;
+    base_out= 0;
+    at_end= false;
+    setg(&buf[history_size], &buf[history_size], &buf[history_size]);
+  }
+
+  DecompressBuf::~DecompressBuf() {
+  }
+
+  const char* DecompressBuf::Detect(const char *b, size_t n) {
+    const unsigned char *u= reinterpret_cast<const unsigned char*>(b);
+    if(n >= 2 && u[0] == 0x1f && u[1] == 0x8b) {
+      return "gzip";
+    }
+    if(n >= 4 && u[0] == 0x28 && u[1] == 0xb5 && u[2] == 0x2f && u[3] == 0xfd) {
+      return "zstd";
+    }
+    return NULL;
+  }
+
+  DecompressBuf* DecompressBuf::Create(const char *format, std::streambuf *source, int64_t s) {
+    if(strcmp(format, "gzip") == 0) {
+      return new GzipBuf(source, s);
+    }
+#ifdef LAMMPSREADER_ZSTD
+    if(strcmp(format, "zstd") == 0) {
+      return new ZstdBuf(source, s);
+    }
+#endif
+    return NULL;
+  }
+
+  void DecompressBuf::addPoint(int64_t out, int64_t in, int bits, const char *window, size_t wsize) {
+    //only points beyond the ones we already have are worth keeping
+    if(out <= 0 || (!points.empty() && out < points.back().out + span)) {
+      return;
+    }
+    AccessPoint p;
+    p.out= out;
+    p.in= in;
+    p.bits= bits;
+    p.window.assign(window, window + wsize);
+    points.push_back(p);
+  }
+
+  size_t DecompressBuf::refill(std::vector<char>& in, int64_t& in_base, size_t consumed) {
+    in_base+= consumed;
+    std::streamsize n= src->sgetn(&in[0], in.size());
+    return (n > 0) ? n : 0;
+  }
+
+  DecompressBuf::int_type DecompressBuf::underflow() {
+    if(gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    if(at_end || failed) {
+      return traits_type::eof();
+    }
+    //keep the end of what we just handed out as history, in front of the new data
+    char *data= &buf[history_size];
+    size_t produced= egptr() - data;
+    if(produced > 0) {
+      size_t keep= std::min(history_size, hist_len + produced);
+      memmove(data - keep, data + produced - keep, keep);
+      hist_len= keep;
+      base_out+= produced;
+    }
+    size_t n= decompress(data, out_chunk);
+    setg(data, data, data + n);
+    if(n == 0) {
+      at_end= true;
+      return traits_type::eof();
+    }
+    return traits_type::to_int_type(*gptr());
+  }
+
+  bool DecompressBuf::resetTo(const AccessPoint *p) {
+    char *data= &buf[history_size];
+    at_end= false;
+    if(p) {
+      hist_len= p->window.size();
+      if(hist_len > 0) {
+	memcpy(data - hist_len, &p->window[0], hist_len);
+      }
+      base_out= p->out;
+    } else {
+      hist_len= 0;
+      base_out= 0;
+    }
+    setg(data, data, data);
+    return restart(p);
+  }
+
+  DecompressBuf::pos_type DecompressBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if(!(which & std::ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+    off_type here= base_out + (gptr() - &buf[history_size]);
+    if(dir == std::ios_base::cur) {
+      if(off == 0) {
+	return pos_type(here);
+      }
+      return seekpos(pos_type(here + off), which);
+    } else if(dir == std::ios_base::beg) {
+      return seekpos(pos_type(off), which);
+    }
+    //the only way to find the end is to decompress everything
+    setg(eback(), egptr(), egptr());
+    while(underflow() != traits_type::eof()) {
+      setg(eback(), egptr(), egptr());
+    }
+    return seekpos(pos_type(base_out + (egptr() - &buf[history_size]) + off), which);
+  }
+
+  DecompressBuf::pos_type DecompressBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    off_type target= pos;
+    if(!(which & std::ios_base::in) || target < 0) {
+      return pos_type(off_type(-1));
+    }
+    char *data= &buf[history_size];
+    off_type have_end= base_out + (egptr() - data);
+    //the nearest access point at or before the target
+    const AccessPoint *best= NULL;
+    for(std::vector<AccessPoint>::const_iterator it= points.begin(); it < points.end() && it->out <= target; it++) {
+      best= &(*it);
+    }
+    if(target < base_out || (best && best->out > have_end)) {
+      //going backwards, or far enough forwards to be worth jumping
+      if(!resetTo(best)) {
+	failed= true;
+	return pos_type(off_type(-1));
+      }
+      have_end= base_out;
+    }
+    //then decompress forwards until we reach the target
+    while(target > have_end) {
+      setg(eback(), egptr(), egptr());
+      if(underflow() == traits_type::eof()) {
+	return pos_type(off_type(-1));
+      }
+      have_end= base_out + (egptr() - &buf[history_size]);
+    }
+    setg(eback(), &buf[history_size] + (target - base_out), egptr());
+    return pos;
+  }
+
+  //the sidecar file starts with these 8 bytes
+  static const char points_magic[8]= {'L', 'R', 'Z', 'I', 'N', 'D', 'X', '1'};
+
+  bool DecompressBuf::SavePoints(const std::string& filename, int64_t size, int64_t mtime) const {
+    //written under a name of its own and then renamed, as the frame index is
+    std::ostringstream tmp;
+    tmp << filename << ".tmp" << getpid() << "." << this;
+    std::ofstream out(tmp.str().c_str(), std::ios::binary | std::ios::trunc);
+    if(!out.is_open()) {
+      return false;
+    }
+    int64_t n= points.size();
+    out.write(points_magic, sizeof(points_magic));
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(reinterpret_cast<const char*>(&mtime), sizeof(mtime));
+    out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    for(std::vector<AccessPoint>::const_iterator it= points.begin(); it < points.end(); it++) {
+      int32_t bits= it->bits;
+      int32_t wsize= it->window.size();
+      out.write(reinterpret_cast<const char*>(&it->out), sizeof(it->out));
+      out.write(reinterpret_cast<const char*>(&it->in), sizeof(it->in));
+      out.write(reinterpret_cast<const char*>(&bits), sizeof(bits));
+      out.write(reinterpret_cast<const char*>(&wsize), sizeof(wsize));
+      if(wsize > 0) {
+	out.write(&it->window[0], wsize);
+      }
+    }
+    out.close();
+    if(out.fail() || rename(tmp.str().c_str(), filename.c_str()) != 0) {
+      remove(tmp.str().c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool DecompressBuf::LoadPoints(const std::string& filename, int64_t size, int64_t mtime) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if(!in.is_open()) {
+      return false;
+    }
+    char magic[8];
+    int64_t fsize, fmtime, n;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&fsize), sizeof(fsize));
+    in.read(reinterpret_cast<char*>(&fmtime), sizeof(fmtime));
+    in.read(reinterpret_cast<char*>(&n), sizeof(n));
+    if(in.fail() || memcmp(magic, points_magic, sizeof(magic)) != 0 || fsize != size || fmtime != mtime || n < 0) {
+      return false;
+    }
+    std::vector<AccessPoint> loaded(n);
+    for(int64_t i= 0; i < n; i++) {
+      int32_t bits, wsize;
+      in.read(reinterpret_cast<char*>(&loaded[i].out), sizeof(loaded[i].out));
+      in.read(reinterpret_cast<char*>(&loaded[i].in), sizeof(loaded[i].in));
+      in.read(reinterpret_cast<char*>(&bits), sizeof(bits));
+      in.read(reinterpret_cast<char*>(&wsize), sizeof(wsize));
+      if(in.fail() || wsize < 0 || wsize > static_cast<int32_t>(history_size)) {
+	return false;
+      }
+      loaded[i].bits= bits;
+      loaded[i].window.resize(wsize);
+      if(wsize > 0) {
+	in.read(&loaded[i].window[0], wsize);
+      }
+    }
+    if(in.fail()) {
+      return false;
+    }
+    points.swap(loaded);
+    return true;
+  }
+
+  GzipBuf::GzipBuf(std::streambuf *source, int64_t s) : DecompressBuf(source, s) {
+    in.resize(in_chunk);
+    memset(&strm, 0, sizeof(strm));
+    //47 lets zlib read either a gzip or a zlib header
+    if(inflateInit2(&strm, 47) != Z_OK) {
+      std::cerr << "ERROR: Failed to initialise zlib." << std::endl;
+      failed= true;
+    }
+    in_base= 0;
+    raw= false;
+    finished= false;
+  }
+
+  GzipBuf::~GzipBuf() {
+    inflateEnd(&strm);
+  }
+
+  bool GzipBuf::skipInput(size_t n) {
+    //throws away n bytes of input, such as a gzip trailer
+    while(n > 0) {
+      if(strm.avail_in == 0) {
+	strm.avail_in= refill(in, in_base, strm.next_in - reinterpret_cast<Bytef*>(&in[0]));
+	strm.next_in= reinterpret_cast<Bytef*>(&in[0]);
+	if(strm.avail_in == 0) {
+	  return false;
+	}
+      }
+      size_t k= std::min(n, static_cast<size_t>(strm.avail_in));
+      strm.next_in+= k;
+      strm.avail_in-= k;
+      n-= k;
+    }
+    return true;
+  }
+
+  size_t GzipBuf::decompress(char *out, size_t n) {
+    if(finished || failed) {
+      return 0;
+    }
+    strm.next_out= reinterpret_cast<Bytef*>(out);
+    strm.avail_out= n;
+    while(strm.avail_out > 0) {
+      if(strm.avail_in == 0) {
+	strm.avail_in= refill(in, in_base, strm.next_in ? strm.next_in - reinterpret_cast<Bytef*>(&in[0]) : 0);
+	strm.next_in= reinterpret_cast<Bytef*>(&in[0]);
+	if(strm.avail_in == 0) {
+	  std::cerr << "ERROR: The compressed file ended unexpectedly." << std::endl;
+	  failed= true;
+	  break;
+	}
+      }
+      //Z_BLOCK stops at the end of each deflate block, where an access point can go
+      int ret= inflate(&strm, Z_BLOCK);
+      if(ret == Z_STREAM_END) {
+	if(raw && !skipInput(8)) {
+	  std::cerr << "ERROR: The compressed file ended in the middle of a gzip trailer." << std::endl;
+	  failed= true;
+	  break;
+	}
+	//there may be another gzip member following this one
+	if(strm.avail_in == 0) {
+	  strm.avail_in= refill(in, in_base, strm.next_in - reinterpret_cast<Bytef*>(&in[0]));
+	  strm.next_in= reinterpret_cast<Bytef*>(&in[0]);
+	}
+	if(strm.avail_in == 0) {
+	  finished= true;
+	  break;
+	}
+	inflateReset2(&strm, 47);
+	raw= false;
+	continue;
+      }
+      if(ret != Z_OK && ret != Z_BUF_ERROR) {
+	std::cerr << "ERROR: Failed to decompress the file (" << (strm.msg ? strm.msg : "zlib error") << ")." << std::endl;
+	failed= true;
+	break;
+      }
+      if((strm.data_type & 128) && !(strm.data_type & 64)) {
+	size_t done= reinterpret_cast<char*>(strm.next_out) - out;
+	int64_t out_pos= base_out + done;
+	if(points.empty() ? (out_pos >= span) : (out_pos >= points.back().out + span)) {
+	  size_t wsize= std::min(history_size, hist_len + done);
+	  addPoint(out_pos, in_base + (strm.next_in - reinterpret_cast<Bytef*>(&in[0])), strm.data_type & 7,
+		   reinterpret_cast<char*>(strm.next_out) - wsize, wsize);
+	}
+      }
+    }
+    return n - strm.avail_out;
+  }
+
+  bool GzipBuf::restart(const AccessPoint *p) {
+    finished= false;
+    strm.avail_in= 0;
+    strm.next_in= NULL;
+    if(!p) {
+      raw= false;
+      in_base= 0;
+      return src->pubseekpos(0, std::ios_base::in) == std::streampos(0) && inflateReset2(&strm, 47) == Z_OK;
+    }
+    //access points are in the middle of a deflate stream, so there are no headers
+    raw= true;
+    int64_t start= p->in - (p->bits ? 1 : 0);
+    if(src->pubseekpos(start, std::ios_base::in) != std::streampos(start) || inflateReset2(&strm, -15) != Z_OK) {
+      return false;
+    }
+    in_base= start;
+    if(p->bits) {
+      int c= src->sbumpc();
+      if(c == std::char_traits<char>::eof()) {
+	return false;
+      }
+      in_base++;
+      inflatePrime(&strm, p->bits, c >> (8 - p->bits));
+    }
+    if(!p->window.empty()) {
+      inflateSetDictionary(&strm, reinterpret_cast<const Bytef*>(&p->window[0]), p->window.size());
+    }
+    return true;
+  }
+
+#ifdef LAMMPSREADER_ZSTD
+  ZstdBuf::ZstdBuf(std::streambuf *source, int64_t s) : DecompressBuf(source, s) {
+    in.resize(in_chunk);
+    ds= ZSTD_createDStream();
+    if(!ds) {
+      std::cerr << "ERROR: Failed to initialise zstd." << std::endl;
+      failed= true;
+    }
+    inb.src= &in[0];
+    inb.size= 0;
+    inb.pos= 0;
+    in_base= 0;
+    last_ret= 0;
+  }
+
+  ZstdBuf::~ZstdBuf() {
+    ZSTD_freeDStream(ds);
+  }
+
+  size_t ZstdBuf::decompress(char *out, size_t n) {
+    if(failed) {
+      return 0;
+    }
+    ZSTD_outBuffer ob;
+    ob.dst= out;
+    ob.size= n;
+    ob.pos= 0;
+    while(ob.pos < ob.size) {
+      if(inb.pos == inb.size) {
+	inb.size= refill(in, in_base, inb.size);
+	inb.pos= 0;
+	if(inb.size == 0) {
+	  //a clean end is only possible between frames
+	  if(last_ret != 0) {
+	    std::cerr << "ERROR: The compressed file ended unexpectedly." << std::endl;
+	    failed= true;
+	  }
+	  break;
+	}
+      }
+      size_t ret= ZSTD_decompressStream(ds, &ob, &inb);
+      if(ZSTD_isError(ret)) {
+	std::cerr << "ERROR: Failed to decompress the file (" << ZSTD_getErrorName(ret) << ")." << std::endl;
+	failed= true;
+	break;
+      }
+      last_ret= ret;
+      if(ret == 0) {
+	//the end of a zstd frame, and the start of the next, needs no history
+	addPoint(base_out + ob.pos, in_base + inb.pos, 0, NULL, 0);
+      }
+    }
+    return ob.pos;
+  }
+
+  bool ZstdBuf::restart(const AccessPoint *p) {
+    int64_t start= p ? p->in : 0;
+    inb.size= 0;
+    inb.pos= 0;
+    in_base= start;
+    last_ret= 0;
+    ZSTD_DCtx_reset(ds, ZSTD_reset_session_only);
+    return src->pubseekpos(start, std::ios_base::in) == std::streampos(start);
+  }
+#endif
+}
@@ -0,0 +1,130 @@
+/*
+    decompressbuf.h
+    Seekable stream buffers for reading gzip and zstd compressed dump files
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef DECOMPRESSBUF_H
+#define DECOMPRESSBUF_H
+
+#include <cstdint>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+#ifdef LAMMPSREADER_ZSTD
+#include <zstd.h>
+#endif
+
+namespace LAMMPSReaderNS {
+
+  //a read only stream buffer presenting the decompressed contents of its source
+  //positions are positions in the decompressed data
+  //as the data is decompressed, access points are recorded every span bytes or so,
+  //from which decompression can be restarted, so that a seek doesn't have to start
+  //again from the beginning of the file
+  class DecompressBuf : public std::streambuf {
+  public:
+    struct AccessPoint {
+      int64_t out;    //offset in the decompressed data
+      int64_t in;     //offset in the compressed file
+      int bits;       //for gzip, bits of the byte before in which belong to this point
+      std::vector<char> window;  //for gzip, the data just before this point
+    };
+
+    DecompressBuf(std::streambuf *source, int64_t span);
+    virtual ~DecompressBuf();
+
+    //the access points can be saved, and reused as long as the file doesn't change
+    bool SavePoints(const std::string&, int64_t size, int64_t mtime) const;
+    bool LoadPoints(const std::string&, int64_t size, int64_t mtime);
+    bool Failed() const { return failed; }
+
+    //returns "gzip", "zstd" or NULL, depending on the first bytes of a file
+    static const char* Detect(const char*, size_t);
+    static DecompressBuf* Create(const char *format, std::streambuf *source, int64_t span);
+  protected:
+    int_type underflow();
+    pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode);
+    pos_type seekpos(pos_type, std::ios_base::openmode);
+
+    //fills out with up to n bytes of decompressed data, starting at offset base_out,
+    //recording access points as it goes, and returns how many bytes it produced
+    virtual size_t decompress(char *out, size_t n)= 0;
+    //prepares to decompress from an access point, or from the start if p is NULL
+    virtual bool restart(const AccessPoint *p)= 0;
+
+    void addPoint(int64_t out, int64_t in, int bits, const char *window, size_t wsize);
+    size_t refill(std::vector<char>& in, int64_t& in_base, size_t consumed);
+
+    std::streambuf *src;
+    int64_t span;
+    std::vector<AccessPoint> points;
+    bool failed;
+
+    //the decompressed data lives at buf[history_size] onwards, with up to
+    //history_size bytes of the data before it kept just in front
+    static const size_t history_size= 32768;
+    std::vector<char> buf;
+    size_t hist_len;
+    int64_t base_out;
+    bool at_end;
+  private:
+    bool resetTo(const AccessPoint *p);
+  };
+
+  class GzipBuf : public DecompressBuf {
+  public:
+    GzipBuf(std::streambuf *source, int64_t span);
+    ~GzipBuf();
+  protected:
+    size_t decompress(char *out, size_t n);
+    bool restart(const AccessPoint *p);
+  private:
+    z_stream strm;
+    std::vector<char> in;
+    int64_t in_base;
+    //raw is true after restarting from an access point, when there are no gzip headers
+    bool raw;
+    bool finished;
+    bool skipInput(size_t);
+  };
+
+#ifdef LAMMPSREADER_ZSTD
+  //zstd can only restart at the start of a zstd frame, so random access needs a file
+  //made up of many frames, such as those written by pzstd or zstd --adapt -B
+  class ZstdBuf : public DecompressBuf {
+  public:
+    ZstdBuf(std::streambuf *source, int64_t span);
+    ~ZstdBuf();
+  protected:
+    size_t decompress(char *out, size_t n);
+    bool restart(const AccessPoint *p);
+  private:
+    ZSTD_DStream *ds;
+    std::vector<char> in;
+    ZSTD_inBuffer inb;
+    int64_t in_base;
+    size_t last_ret;
+  };
+#endif
+}
+
+#endif
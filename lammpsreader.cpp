@@ -20,14 +20,32 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
-#include <map>
+#include <limits>
+#include <functional>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "decompressbuf.h"
 #include "lammpsreader.h"
+#include "numparse.h"
+#include "readahead.h"
 
 namespace LAMMPSReaderNS {
   std::vector<std::string> explode(std::string s) {
@@ -49,11 +67,115 @@ namespace LAMMPSReaderNS {
     return v;	
   }
 	
+  static bool is_space(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r';
+  }
+
+  //finds the next whitespace separated token in [p, e), leaving p just past it
+  static bool next_token(const char *&p, const char *e, const char *&tb, const char *&te) {
+    while(p < e && is_space(*p)) {
+      p++;
+    }
+    if(p == e) {
+      return false;
+    }
+    tb= p;
+    while(p < e && !is_space(*p)) {
+      p++;
+    }
+    te= p;
+    return true;
+  }
+
+  //compressed files get an access point roughly this often, in decompressed bytes
+  static const int64_t access_point_span= 1 << 24;
+
+  //in follow mode, how often the file is checked for growth when inotify can't say
+  static const int follow_poll_ms= 100;
+
+  //frames smaller than this aren't worth splitting between threads
+  static const int64_t parallel_threshold= 65536;
+
+  //how many atoms of a binary block are decoded at a time for a callback
+  static const size_t block_chunk= 65536;
+
+  //calls fn(0) ... fn(n-1), each on its own thread
+  static void run_parallel(int n, const std::function<void(int)>& fn) {
+    std::vector<std::thread> pool;
+    for(int i= 1; i < n; i++) {
+      pool.push_back(std::thread(fn, i));
+    }
+    fn(0);
+    for(std::vector<std::thread>::iterator it= pool.begin(); it < pool.end(); it++) {
+      it->join();
+    }
+  }
+
+  static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void ReaderStats::Reset() {
+    bytes= 0;
+    frames= 0;
+    atoms= 0;
+    io_ns= 0;
+    tokenize_ns= 0;
+    convert_ns= 0;
+    callback_ns= 0;
+    total_ns= 0;
+  }
+
+  std::string ReaderStats::ToJSON() const {
+    std::ostringstream out;
+    out << "{\"bytes\": " << bytes << ", \"frames\": " << frames << ", \"atoms\": " << atoms
+	<< ", \"io_ns\": " << io_ns << ", \"tokenize_ns\": " << tokenize_ns << ", \"convert_ns\": " << convert_ns
+	<< ", \"callback_ns\": " << callback_ns << ", \"total_ns\": " << total_ns << "}";
+    return out.str();
+  }
+
+  int64_t LAMMPSReader::startLap() const {
+    return collect_stats ? now_ns() : 0;
+  }
+
+  void LAMMPSReader::lap(int64_t& phase, int64_t& t) const {
+    if(collect_stats) {
+      int64_t n= now_ns();
+      phase+= n - t;
+      t= n;
+    }
+  }
+
+  static bool token_is(const char *b, const char *e, const char *s) {
+    size_t len= strlen(s);
+    return (static_cast<size_t>(e - b) == len) && (memcmp(b, s, len) == 0);
+  }
+
   LAMMPSReader::LAMMPSReader() {
     //initialise the variables
     wrap= true;
+    threads= 1;
+    stride= 1;
+    id_order= false;
+    id_rows= 0;
+    collect_stats= false;
+    follow= false;
+    follow_timeout= 0.0;
+    follow_fd= -1;
+    frame_end= -1;
+    pending_skip= 0;
+    range_end= -1;
     last_tstep= -1;
     n_atoms= 0;
+    binary= false;
+    readahead= NULL;
+    decompressor= NULL;
+    mapped= false;
+    map_begin= NULL;
+    map_size= 0;
+    map_pos= 0;
+    plan_columns= 0;
+    filter_span= 0;
     for(int i= 0; i < 3; i++) {
       box_lo[i]= 0.0;
       box_hi[i]= 0.0;
@@ -67,10 +189,8 @@ namespace LAMMPSReaderNS {
     close();
   }
 
-  bool LAMMPSReader::open(const std::string& filename, bool bin) {
-    if(file.is_open()) {
-      file.close();
-    }
+  bool LAMMPSReader::open(const std::string& filename, bool bin, bool map) {
+    close();
     if(bin) {
       file.open(filename.c_str(), std::ios::binary);
     } else {
@@ -82,191 +202,750 @@ namespace LAMMPSReaderNS {
     }
     curfile= filename;
     binary= bin;
+    index.clear();
+    pending_skip= 0;
+    range_end= -1;
+    //a new trajectory starts a new id_order layout
+    id_rows= 0;
+    //compressed files are recognised by their first few bytes
+    char magic[4]= {0, 0, 0, 0};
+    file.read(magic, sizeof(magic));
+    std::streamsize nmagic= file.gcount();
+    file.clear();
+    file.seekg(0);
+    const char *format= DecompressBuf::Detect(magic, nmagic);
+    if(format) {
+      decompressor= DecompressBuf::Create(format, file.rdbuf(), access_point_span);
+      if(!decompressor) {
+	std::cerr << "Error! " << filename << " is " << format << " compressed, but LAMMPSReader was built without " << format << " support." << std::endl;
+	close();
+	return false;
+      }
+      static_cast<std::istream&>(file).rdbuf(decompressor);
+      //reuse the access points from an earlier pass over the file, if there was one
+      struct stat st;
+      if(stat(filename.c_str(), &st) == 0) {
+	decompressor->LoadPoints(pointsName(), st.st_size, st.st_mtime);
+      }
+      //a compressed file can't be parsed in place
+      map= false;
+    }
+    if(map && !bin) {
+      //map the whole file, so that the text can be parsed where it lies
+      //the stream stays open too, for indexing
+      struct stat st;
+      if(stat(filename.c_str(), &st) != 0) {
+	std::cerr << "Error! Failed to stat file " << filename << std::endl;
+	close();
+	return false;
+      }
+      map_size= st.st_size;
+      map_pos= 0;
+      mapped= true;
+      if(map_size > 0) {
+	int fd= ::open(filename.c_str(), O_RDONLY);
+	void *addr= (fd < 0) ? MAP_FAILED : mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(fd >= 0) {
+	  ::close(fd);
+	}
+	if(addr == MAP_FAILED) {
+	  std::cerr << "Error! Failed to memory map file " << filename << std::endl;
+	  close();
+	  return false;
+	}
+	madvise(addr, map_size, MADV_SEQUENTIAL);
+	map_begin= static_cast<const char*>(addr);
+      }
+    }
     return true;
   }
 
   void LAMMPSReader::close() {
+    if(readahead || decompressor) {
+      //put the file's own buffer back before closing it
+      static_cast<std::istream&>(file).rdbuf(file.rdbuf());
+    }
+    delete readahead;
+    readahead= NULL;
+    delete decompressor;
+    decompressor= NULL;
     if(file.is_open()) {
       file.close();
     }
+    if(map_begin) {
+      munmap(const_cast<char*>(map_begin), map_size);
+    }
+    mapped= false;
+    map_begin= NULL;
+    map_size= 0;
+    map_pos= 0;
+    if(follow_fd >= 0) {
+      ::close(follow_fd);
+    }
+    follow_fd= -1;
     curfile= "";
+    index.clear();
+  }
+
+  bool LAMMPSReader::EnablePrefetch(size_t depth, size_t chunk) {
+    //everything that reads the stream (ReadFrame, indexing, seeking) goes through the
+    //read-ahead buffer from now on, until the file is closed
+    if(!file.is_open()) {
+      std::cerr << "LAMMPSReader::EnablePrefetch() called while no file is open." << std::endl;
+      return false;
+    }
+    if(mapped) {
+      std::cerr << "ERROR: Prefetching can't be used with a memory mapped file, which the operating system already reads ahead. (" << curfile << ")" << std::endl;
+      return false;
+    }
+    if(readahead) {
+      return true;
+    }
+    file.clear();
+    //for a compressed file, the decompression happens on the background thread too
+    if(decompressor) {
+      readahead= new ReadAheadBuf(decompressor, depth, chunk);
+    } else {
+      readahead= new ReadAheadBuf(file.rdbuf(), depth, chunk);
+    }
+    static_cast<std::istream&>(file).rdbuf(readahead);
+    return true;
   }
 
   bool LAMMPSReader::ReadFrame(const std::string& s, Callback *c) {
     //if this is a text file, s tells us which properties the user
     //wants us to extract from the file
     //if this is a binary file, s tells us ALL of the properties in the dump file
-    //s tells us what properties the user wants us to extract from the file
-    std::vector<std::string> args= explode(s);
+    if(id_order) {
+      //the atoms have to be put in order before the callbacks see any of them
+      if(!ReadFrameInto(splitArgs(s), NULL, &ordered)) {
+	return false;
+      }
+      int64_t t= startLap();
+      ReplayFrame(ordered, c);
+      if(collect_stats) {
+	int64_t n= now_ns();
+	stats.callback_ns+= n - t;
+	stats.total_ns+= n - t;
+      }
+      return true;
+    }
+    return ReadFrameInto(splitArgs(s), c, NULL);
+  }
+
+  bool LAMMPSReader::ReadFrame(const std::string& s, Frame& f) {
+    //as above, but the whole frame is stored in f instead of being passed to callbacks
+    return ReadFrameInto(splitArgs(s), NULL, &f);
+  }
+
+  const std::vector<std::string>& LAMMPSReader::splitArgs(const std::string& s) {
+    //the same arguments are normally given for every frame, so they're only split up when they change
+    if(split_args.empty() || s != last_args) {
+      last_args= s;
+      split_args= explode(s);
+    }
+    return split_args;
+  }
+
+  void LAMMPSReader::SetBinaryColumns(const std::string& s) {
+    //an empty string goes back to expecting every column in the arguments to ReadFrame()
+    binary_columns= explode(s);
+  }
+
+  void LAMMPSReader::AddFilter(const std::string& property, double lo, double hi) {
+    //keeps only the atoms with lo <= property <= hi, after wrapping if it's a position
+    Filter flt;
+    flt.property= property;
+    flt.by_id= false;
+    flt.lo= lo;
+    flt.hi= hi;
+    filters.push_back(flt);
+  }
+
+  void LAMMPSReader::FilterIds(const std::vector<int>& ids) {
+    //keeps only the atoms whose id is in ids
+    filter_ids= ids;
+    std::sort(filter_ids.begin(), filter_ids.end());
+    Filter flt;
+    flt.property= "id";
+    flt.by_id= true;
+    flt.lo= 0.0;
+    flt.hi= 0.0;
+    filters.push_back(flt);
+  }
+
+  void LAMMPSReader::FilterRegion(const double lo[3], const double hi[3]) {
+    AddFilter("x", lo[0], hi[0]);
+    AddFilter("y", lo[1], hi[1]);
+    AddFilter("z", lo[2], hi[2]);
+  }
+
+  void LAMMPSReader::ClearFilters() {
+    filters.clear();
+    filter_ids.clear();
+    filter_span= 0;
+  }
+
+  void LAMMPSReader::ReplayFrame(const Frame& f, Callback *c) {
+    last_tstep= f.timestep;
+    n_atoms= static_cast<int>(f.n_atoms);
+    memcpy(boundaries, f.boundaries, sizeof(boundaries));
+    for(int i= 0; i < 3; i++) {
+      box_lo[i]= f.box_lo[i];
+      box_hi[i]= f.box_hi[i];
+    }
+    c->StartOfTimestep(this);
+    c->BoxBounds(boundaries, box_lo, box_hi);
+    //only the properties the frame holds are copied
+    replay_slots.clear();
+    for(size_t i= 0; i < n_property_slots; i++) {
+      const PropertySlot& slot= property_slots[i];
+      if(slot.icol ? !(f.*slot.icol).empty() : !(f.*slot.dcol).empty()) {
+	replay_slots.push_back(&slot);
+      }
+    }
+    AtomData ad;
+    memset(&ad, 0, sizeof(AtomData));
+    for(size_t i= 0; i < f.size(); i++) {
+      //rows left empty by id_order have no atom in them
+      if(!f.id.empty() && f.id[i] == 0) {
+	continue;
+      }
+      for(std::vector<const PropertySlot*>::const_iterator it= replay_slots.begin(); it < replay_slots.end(); it++) {
+	if((*it)->icol) {
+	  ad.*(*it)->islot= (f.*(*it)->icol)[i];
+	} else {
+	  ad.*(*it)->dslot= (f.*(*it)->dcol)[i];
+	}
+      }
+      c->AtomLine(ad, this);
+    }
+    c->EndOfTimestep(this);
+  }
+
+  bool LAMMPSReader::ReadFrameInto(const std::vector<std::string>& args, Callback *c, Frame *f) {
+    //exactly one of c and f is used
     if(!file.is_open()) {
       std::cerr << "LAMMPSReader::ReadFrame() called while no file is open." << std::endl;
       return false;
     }
+    int64_t start= startLap();
+    frame_end= -1;
+    if(follow) {
+      if(!followFrame()) {
+	return false;
+      }
+    } else if(pending_skip > 0) {
+      if(!SkipFrames(0)) {
+	return false;
+      }
+    }
+    if(pastRange()) {
+      return false;
+    }
+    //bytes are counted from here, so that skipped frames don't count as read
+    size_t start_pos= map_pos;
+    bool ok;
     if(binary) {
       //this is a binary file, which is handled a little differently
-      return ReadBinaryFrame(args, c);
+      ok= ReadBinaryFrame(args, c, f);
+    } else if(mapped) {
+      //when following, the end of the mapping is pulled in to the end of the frame,
+      //so that the start of a frame still being written isn't mistaken for part of this one
+      size_t full_size= map_size;
+      if(frame_end >= 0) {
+	map_size= frame_end;
+      }
+      ok= ReadMappedFrame(args, c, f);
+      map_size= full_size;
+    } else {
+      ok= ReadTextFrame(args, c, f);
+    }
+    if(ok && f && id_order) {
+      ok= orderById(*f);
+    }
+    if(ok && collect_stats) {
+      stats.frames++;
+      stats.atoms+= n_atoms;
+      if(mapped) {
+	stats.bytes+= map_pos - start_pos;
+      }
+      stats.total_ns+= now_ns() - start;
     }
+    //the frames in between are skipped on the next call, so that reading stops cleanly at the end of the file
+    if(ok && stride > 1) {
+      pending_skip= stride - 1;
+    }
+    return ok;
+  }
+
+  bool LAMMPSReader::ReadTextFrame(const std::vector<std::string>& args, Callback *c, Frame *f) {
     if(file.eof()) {
       //we're already at the end, so no more to read
       return false;
     }
-    std::string line;
+    //the line and its tokens are kept in buffers which last from one frame to the next,
+    //so that once they're big enough, reading allocates nothing
     bool insideTstep= false;
-    //the map is sorted by key, which makes output look awkward
-    //because it's not in the same order as in the file.
-    //store a vector as well, which are sorted in the order by which values were pushed on
-    std::map<std::string, int> columns;
-    std::vector<std::string> avail_columns;
+    size_t row= 0;
+    size_t lines= 0;
     std::ifstream::streampos line_start= file.tellg();
-    while(std::getline(file, line)) {
+    std::streampos frame_start= line_start;
+    int64_t t0= startLap();
+    //when following, nothing beyond the end of the frame is read
+    while((frame_end < 0 || line_start < frame_end) && std::getline(file, line_buf)) {
+      lap(stats.io_ns, t0);
       //process any information about the frame
-      //tokenize the string
-      std::vector<std::string> v= explode(line);
-      if(v[0].compare("ITEM:") == 0) {
-	if(v[1].compare("TIMESTEP") == 0) {
+      //tokenize the line in place
+      tokenizeLine(line_buf);
+      lap(stats.tokenize_ns, t0);
+      if(tokens.empty()) {
+	line_start= file.tellg();
+	continue;
+      }
+      if(token_is(tokens[0].begin, tokens[0].end, "ITEM:") && tokens.size() > 1) {
+	const Token& item= tokens[1];
+	if(token_is(item.begin, item.end, "TIMESTEP")) {
 	  //the next line contains the current timestep
 	  if(insideTstep) {
 	    //but we're already in a timestep, so seeing this line means we've hit the end of the timestep
 	    //go back one line in the file, then return from this function
-	    c->EndOfTimestep(this);
 	    file.seekg(line_start);
+	    if(collect_stats) {
+	      stats.bytes+= line_start - frame_start;
+	    }
+	    if(f) {
+	      return FinishFrame(*f, lines, row);
+	    }
+	    c->EndOfTimestep(this);
 	    return true;
 	  } else {
-	    c->StartOfTimestep(this);
+	    if(c) {
+	      c->StartOfTimestep(this);
+	    }
 	    insideTstep= true;
 	  }
-	  if(std::getline(file, line)) {
-	    last_tstep= atoi(line.c_str());
-	  } else {
+	  if(!std::getline(file, line_buf)) {
 	    std::cerr << "ERROR: Failed to read a timestep after an ITEM: TIMESTEP line. (" << curfile << ")" << std::endl;
 	    return false;
 	  }
-  } else if(v[1].compare("NUMBER") == 0) {
+	  if(!ParseInt(line_buf.data(), line_buf.data() + line_buf.size(), last_tstep)) {
+	    std::cerr << "ERROR: Malformed timestep '" << line_buf << "' after an ITEM: TIMESTEP line. (" << curfile << ")" << std::endl;
+	    return false;
+	  }
+	} else if(token_is(item.begin, item.end, "NUMBER")) {
 	  //the next line contains the number of atoms
-	  if(std::getline(file, line)) {
-	    n_atoms= atoi(line.c_str());
-	  } else {
-	    std::cerr << "ERROR: Failed to read a timestep after an ITEM: TIMESTEP line. (" << curfile << ")" << std::endl;
+	  if(!std::getline(file, line_buf)) {
+	    std::cerr << "ERROR: Failed to read the number of atoms after an ITEM: NUMBER OF ATOMS line. (" << curfile << ")" << std::endl;
+	    return false;
+	  }
+	  if(!ParseInt(line_buf.data(), line_buf.data() + line_buf.size(), n_atoms) || n_atoms < 0) {
+	    std::cerr << "ERROR: Malformed number of atoms '" << line_buf << "' after an ITEM: NUMBER OF ATOMS line. (" << curfile << ")" << std::endl;
 	    return false;
-	  }				
-	} else if(v[1].compare("BOX") == 0) {
+	  }
+	} else if(token_is(item.begin, item.end, "BOX")) {
 	  //the remaining 3 tokens on this line specify the nature of the boundaries
-	  if(v.size() < 6) {
-	    std::cerr << "ERROR: Malformed ITEM: BOX BOUNDS line. Expected 6 tokens, only found " << v.size() << ". The offending line is: " << std::endl;
-	    std::cerr << line <<  " (" << curfile << ")" <<std::endl;
+	  if(tokens.size() < 6) {
+	    std::cerr << "ERROR: Malformed ITEM: BOX BOUNDS line. Expected 6 tokens, only found " << tokens.size() << ". The offending line is: " << std::endl;
+	    std::cerr << line_buf <<  " (" << curfile << ")" <<std::endl;
 	    return false;
 	  } else {
 	    for(int i= 0; i < 3; i++) {
-	      boundaries[i][0]= v[i+3][0];
-	      boundaries[i][1]= v[i+3][1];
+	      boundaries[i][0]= tokens[i+3].begin[0];
+	      boundaries[i][1]= (tokens[i+3].end - tokens[i+3].begin > 1) ? tokens[i+3].begin[1] : '\0';
 	    }
 	  }
 	  //the next 3 lines contain box dimensions
-	  for(int i= 0; (i < 3) && std::getline(file, line); i++) {
+	  for(int i= 0; (i < 3) && std::getline(file, line_buf); i++) {
 	    //we should have two tokens in each line, a lower bound and an upper bound
-	    std::vector<std::string> tokens= explode(line);
+	    tokenizeLine(line_buf);
 	    if(tokens.size() < 2) {
-	      std::cerr << "ERROR: Malformed box bounds line. Expected 2 tokens, only found " << v.size() << ". The offending line is: " << std::endl;
-	      std::cerr << line  << "(" << curfile << ")" << std::endl;
+	      std::cerr << "ERROR: Malformed box bounds line. Expected 2 tokens, only found " << tokens.size() << ". The offending line is: " << std::endl;
+	      std::cerr << line_buf  << "(" << curfile << ")" << std::endl;
+	      return false;
+	    } else if(!ParseDouble(tokens[0].begin, tokens[0].end, box_lo[i]) || !ParseDouble(tokens[1].begin, tokens[1].end, box_hi[i])) {
+	      std::cerr << "ERROR: Malformed box bounds line. The bounds aren't numbers. The offending line is: " << std::endl;
+	      std::cerr << line_buf  << "(" << curfile << ")" << std::endl;
 	      return false;
-	    } else {
-	      box_lo[i]= atof(tokens[0].c_str());
-	      box_hi[i]= atof(tokens[1].c_str());
 	    }
 	  }
-	  c->BoxBounds(boundaries, box_lo, box_hi);
-	} else if(v[1].compare("ATOMS") == 0) {
+	  if(c) {
+	    c->BoxBounds(boundaries, box_lo, box_hi);
+	  }
+	} else if(token_is(item.begin, item.end, "ATOMS")) {
 	  //the remaining tokens on this line tell us what data we're going to get
-	  for(int i= 2; i < (int)v.size(); i++) {
-	    columns[v[i]]= i - 2;
-	    avail_columns.push_back(v[i]);
-	  }
-	  //now check that the user didn't request a field that we don't have
-	  for(std::vector<std::string>::iterator it= args.begin(); it < args.end(); it++) {
-	    if(columns.count(*it) == 0) {
-	      //one of the requested columns isn't in the file
-	      std::cerr << "ERROR: '" << *it << "' was requested from the dump file, but it doesn't appear to exist. The available data in this frame (tstep = " << last_tstep << ") are: ";
-	      for(std::vector<std::string>::iterator jt= avail_columns.begin(); jt < avail_columns.end(); jt++) {
-		std::cerr << *jt << " ";
-	      }
-	      std::cerr << " (" << curfile << ")" << std::endl;
-	      return false;
-	    }
+	  setColumns(tokens.begin() + 2, tokens.end());
+	  if(!CompilePlan(args, avail_columns)) {
+	    return false;
+	  }
+	  if(f) {
+	    PrepareFrame(*f);
 	  }
 	}
       } else {
-	//atom data line
-	AtomData ad;
-	//make sure that everything is zeroed
-	//if the user does something silly (like accessing a field they haven't requested), they'll just see a zero
-	memset(&ad, 0, sizeof(AtomData));
-
-	if(v.size() != avail_columns.size()) {
-	  std::cerr << "ERROR: Mismatch between the number of columns reported and the number of columns read. The LAMMPS header lines indicate " << avail_columns.size() << " columns, but only " << v.size() << " were read. (" << curfile << ")" << std::endl;
+	if(tokens.size() != plan_columns) {
+	  std::cerr << "ERROR: Mismatch between the number of columns reported and the number of columns read. The LAMMPS header lines indicate " << plan_columns << " columns, but only " << tokens.size() << " were read. (" << curfile << ")" << std::endl;
 	  return false;
 	}
 
 	//process the columns that the user wants
-	for(std::vector<std::string>::iterator it= args.begin(); it < args.end(); it++) {
-	  std::string property= *it;
-	  int col= columns[property];
-	  if(!updateAtomData(ad, property, v[col])) {
-	    std::cerr << "ERROR: LAMMPSReader doesn't know what to do with the property '" << property << "'. This is a shortcoming in LAMMPSReader. ReadFrame will now return false as a precautionary measure, to prevent the return of uninitialised variables." << std::endl;
-	    std::cerr << "Aside for the technically minded: To correct this error, modify the private function LAMMPSReader::updateAtomData(AtomData&, std::string, std::string). Add a new Assign line, of the form 'Assign(" << property << ", f)', where f is the function that converts a C-style string to the same type as " << property << " i.e. atoi, atof, etc. (" << curfile << ")" << std::endl;
+	if(f && lines++ >= f->size()) {
+	  std::cerr << "ERROR: Timestep " << last_tstep << " has more atom lines than the " << n_atoms << " given by ITEM: NUMBER OF ATOMS. (" << curfile << ")" << std::endl;
+	  return false;
+	}
+	int pass= filters.empty() ? 1 : filterAtom(tokens);
+	if(pass < 0) {
+	  badNumber(tokens);
+	  return false;
+	} else if(pass == 0) {
+	  //this atom has been filtered out
+	  lap(stats.convert_ns, t0);
+	} else if(f) {
+	  if(!applyPlan(*f, row++, tokens)) {
+	    badNumber(tokens);
 	    return false;
 	  }
-	  
-	  //check the PBCs
-	  //LAMMPS only updates them on reneighbouring steps
-	  if(wrap) {
-	    if((property.compare("x") == 0) && (boundaries[0][0] == 'p') && (ad.x < box_lo[0])) {
-	      ad.x+= (box_hi[0] - box_lo[0]);
-	    } else if((property.compare("x") == 0) && (boundaries[0][1] == 'p') && (ad.x >= box_hi[0])) {
-	      ad.x-= (box_hi[0] - box_lo[0]);
-	    } else if((property.compare("y") == 0) && (boundaries[1][0] == 'p') && (ad.y < box_lo[1])) {
-	      ad.y+= (box_hi[1] - box_lo[1]);
-	    } else if((property.compare("y") == 0) && (boundaries[1][1] == 'p') && (ad.y >= box_hi[1])) {
-	      ad.y-= (box_hi[1] - box_lo[1]);
-	    } else if((property.compare("z") == 0) && (boundaries[2][0] == 'p') && (ad.z < box_lo[2])) {
-	      ad.z+= (box_hi[2] - box_lo[2]);
-	    } else if((property.compare("z") == 0) && (boundaries[2][1] == 'p') && (ad.z >= box_hi[2])) {
-	      ad.z-= (box_hi[2] - box_lo[2]);
-	    } else if((property.compare("xs") == 0) && (boundaries[0][0] == 'p') && (ad.xs <0.0)) {
-	      ad.xs+= 1.0;
-	    } else if((property.compare("xs") == 0) && (boundaries[0][1] == 'p') && (ad.xs >= 1.0)) {
-	      ad.xs-= 1.0;
-	    } else if((property.compare("ys") == 0) && (boundaries[1][0] == 'p') && (ad.ys < 0.0)) {
-	      ad.ys+= 1.0;
-	    } else if((property.compare("ys") == 0) && (boundaries[1][1] == 'p') && (ad.ys >= 1.0)) {
-	      ad.ys-= 1.0;
-	    } else if((property.compare("zs") == 0) && (boundaries[2][0] == 'p') && (ad.zs < 0.0)) {
-	      ad.zs+= 1.0;
-	    } else if((property.compare("zs") == 0) && (boundaries[2][1] == 'p') && (ad.zs >= 1.0)) {
-	      ad.z-= 1.0;
-	    }
+	  lap(stats.convert_ns, t0);
+	} else {
+	  //atom data line
+	  AtomData ad;
+	  //make sure that everything is zeroed
+	  //if the user does something silly (like accessing a field they haven't requested), they'll just see a zero
+	  memset(&ad, 0, sizeof(AtomData));
+	  if(!applyPlan(ad, tokens)) {
+	    badNumber(tokens);
+	    return false;
 	  }
+	  lap(stats.convert_ns, t0);
+	  //pass this atom data onto the callback function that the user provided
+	  c->AtomLine(ad, this);
+	  lap(stats.callback_ns, t0);
 	}
-
-	//pass this atom data onto the callback function that the user provided
-	c->AtomLine(ad, this);
       }
       line_start= file.tellg();
     }
+    if(!insideTstep) {
+      //the stream was at the end without knowing it yet, as it is after skipping the last frame
+      return false;
+    }
+    if(collect_stats && line_start != std::streampos(-1)) {
+      stats.bytes+= line_start - frame_start;
+    }
     //when we hit the end of the file, we've also read a new timestep
+    if(f) {
+      return FinishFrame(*f, lines, row);
+    }
     c->EndOfTimestep(this);
     return true;
   }
-  
-  bool LAMMPSReader::ReadBinaryFrame(const std::vector<std::string>& args, Callback* c) {
+
+  void LAMMPSReader::tokenizeLine(const std::string& line) {
+    tokens.clear();
+    Token t;
+    const char *p= line.data();
+    const char *e= p + line.size();
+    while(next_token(p, e, t.begin, t.end)) {
+      tokens.push_back(t);
+    }
+  }
+
+  void LAMMPSReader::setColumns(std::vector<Token>::const_iterator b, std::vector<Token>::const_iterator e) {
+    //the names are copied into strings which are kept from frame to frame, and short
+    //names fit inside the strings themselves, so this allocates nothing once it has been done once
+    avail_columns.resize(e - b);
+    for(size_t i= 0; b < e; b++, i++) {
+      avail_columns[i].assign(b->begin, b->end);
+    }
+  }
+
+  bool LAMMPSReader::ReadMappedFrame(const std::vector<std::string>& args, Callback *c, Frame *f) {
+    //the same as the text part of ReadFrame, but working directly on the mapped file
+    //lines and tokens are pointers into the mapping, so nothing is copied
+    const char *end= map_begin + map_size;
+    if(map_pos >= map_size) {
+      return false;
+    }
+    bool insideTstep= false;
+    bool inside_atoms= false;
+    size_t row= 0;
+    size_t lines= 0;
+    int64_t t0= startLap();
+    while(map_pos < map_size) {
+      const char *line= map_begin + map_pos;
+      const char *eol= static_cast<const char*>(memchr(line, '\n', end - line));
+      if(!eol) {
+	eol= end;
+      }
+      lap(stats.io_ns, t0);
+      size_t next_pos= (eol - map_begin) + (eol < end ? 1 : 0);
+      //tokenize the line in place
+      //with filters, atom lines are first tokenized only as far as the filters need,
+      //so that a rejected atom costs little more than finding the end of its line
+      tokens.clear();
+      Token t;
+      const char *p= line;
+      size_t limit= (inside_atoms && !filters.empty()) ? filter_span : std::numeric_limits<size_t>::max();
+      while(tokens.size() < limit && next_token(p, eol, t.begin, t.end)) {
+	tokens.push_back(t);
+      }
+      int pass= (tokens.size() == limit && !token_is(tokens[0].begin, tokens[0].end, "ITEM:")) ? filterAtom(tokens) : 1;
+      if(pass < 0) {
+	badNumber(tokens);
+	return false;
+      }
+      bool rejected= (pass == 0);
+      while(!rejected && next_token(p, eol, t.begin, t.end)) {
+	tokens.push_back(t);
+      }
+      lap(stats.tokenize_ns, t0);
+      if(tokens.empty()) {
+	map_pos= next_pos;
+	continue;
+      }
+      if(token_is(tokens[0].begin, tokens[0].end, "ITEM:") && tokens.size() > 1) {
+	const Token& item= tokens[1];
+	if(token_is(item.begin, item.end, "TIMESTEP")) {
+	  if(insideTstep) {
+	    //this is the start of the next frame, leave it for the next call
+	    map_pos= line - map_begin;
+	    if(f) {
+	      return FinishFrame(*f, lines, row);
+	    }
+	    c->EndOfTimestep(this);
+	    return true;
+	  }
+	  if(c) {
+	    c->StartOfTimestep(this);
+	  }
+	  insideTstep= true;
+	  if(next_pos >= map_size) {
+	    std::cerr << "ERROR: Failed to read a timestep after an ITEM: TIMESTEP line. (" << curfile << ")" << std::endl;
+	    return false;
+	  }
+	  const char *nl= static_cast<const char*>(memchr(map_begin + next_pos, '\n', map_size - next_pos));
+	  if(!ParseInt(map_begin + next_pos, nl ? nl : end, last_tstep)) {
+	    std::cerr << "ERROR: Malformed timestep '" << std::string(map_begin + next_pos, nl ? nl : end) << "' after an ITEM: TIMESTEP line. (" << curfile << ")" << std::endl;
+	    return false;
+	  }
+	  next_pos= nl ? (nl - map_begin) + 1 : map_size;
+	} else if(token_is(item.begin, item.end, "NUMBER")) {
+	  if(next_pos >= map_size) {
+	    std::cerr << "ERROR: Failed to read the number of atoms after an ITEM: NUMBER OF ATOMS line. (" << curfile << ")" << std::endl;
+	    return false;
+	  }
+	  const char *nl= static_cast<const char*>(memchr(map_begin + next_pos, '\n', map_size - next_pos));
+	  const char *num_end= nl ? nl : end;
+	  if(!ParseInt(map_begin + next_pos, num_end, n_atoms) || n_atoms < 0) {
+	    std::cerr << "ERROR: Malformed number of atoms '" << std::string(map_begin + next_pos, num_end) << "' after an ITEM: NUMBER OF ATOMS line. (" << curfile << ")" << std::endl;
+	    return false;
+	  }
+	  next_pos= nl ? (nl - map_begin) + 1 : map_size;
+	} else if(token_is(item.begin, item.end, "BOX")) {
+	  if(tokens.size() < 6) {
+	    std::cerr << "ERROR: Malformed ITEM: BOX BOUNDS line. Expected 6 tokens, only found " << tokens.size() << ". (" << curfile << ")" << std::endl;
+	    return false;
+	  }
+	  for(int i= 0; i < 3; i++) {
+	    boundaries[i][0]= tokens[i+3].begin[0];
+	    boundaries[i][1]= (tokens[i+3].end - tokens[i+3].begin > 1) ? tokens[i+3].begin[1] : '\0';
+	  }
+	  //the next 3 lines contain box dimensions
+	  for(int i= 0; i < 3; i++) {
+	    const char *b= map_begin + next_pos;
+	    const char *nl= (next_pos < map_size) ? static_cast<const char*>(memchr(b, '\n', map_size - next_pos)) : NULL;
+	    const char *e= nl ? nl : end;
+	    const char *p= b;
+	    const char *lo_b, *lo_e, *hi_b, *hi_e;
+	    if(!next_token(p, e, lo_b, lo_e) || !next_token(p, e, hi_b, hi_e)) {
+	      std::cerr << "ERROR: Malformed box bounds line. Expected 2 tokens. (" << curfile << ")" << std::endl;
+	      return false;
+	    }
+	    if(!ParseDouble(lo_b, lo_e, box_lo[i]) || !ParseDouble(hi_b, hi_e, box_hi[i])) {
+	      std::cerr << "ERROR: Malformed box bounds line: " << std::string(b, e) << " (" << curfile << ")" << std::endl;
+	      return false;
+	    }
+	    next_pos= nl ? (nl - map_begin) + 1 : map_size;
+	  }
+	  if(c) {
+	    c->BoxBounds(boundaries, box_lo, box_hi);
+	  }
+	} else if(token_is(item.begin, item.end, "ATOMS")) {
+	  setColumns(tokens.begin() + 2, tokens.end());
+	  if(!CompilePlan(args, avail_columns)) {
+	    return false;
+	  }
+	  inside_atoms= true;
+	  if(f) {
+	    PrepareFrame(*f);
+	    if(threads > 1 && n_atoms >= parallel_threshold) {
+	      //big frames have their atoms split between threads
+	      //the threads find, tokenize and convert their lines together, so it all counts as converting
+	      lap(stats.tokenize_ns, t0);
+	      if(!ParseAtomsParallel(*f, next_pos, row)) {
+		return false;
+	      }
+	      lap(stats.convert_ns, t0);
+	      lines= f->size();
+	    }
+	  }
+	}
+      } else {
+	//atom data line
+	if(f && lines++ >= f->size()) {
+	  std::cerr << "ERROR: Timestep " << last_tstep << " has more atom lines than the " << n_atoms << " given by ITEM: NUMBER OF ATOMS. (" << curfile << ")" << std::endl;
+	  return false;
+	}
+	if(rejected) {
+	  //this atom has been filtered out
+	} else if(tokens.size() != plan_columns) {
+	  std::cerr << "ERROR: Mismatch between the number of columns reported and the number of columns read. The LAMMPS header lines indicate " << plan_columns << " columns, but only " << tokens.size() << " were read. (" << curfile << ")" << std::endl;
+	  return false;
+	} else if(f) {
+	  if(!applyPlan(*f, row++, tokens)) {
+	    badNumber(tokens);
+	    return false;
+	  }
+	  lap(stats.convert_ns, t0);
+	} else {
+	  AtomData ad;
+	  memset(&ad, 0, sizeof(AtomData));
+	  if(!applyPlan(ad, tokens)) {
+	    badNumber(tokens);
+	    return false;
+	  }
+	  lap(stats.convert_ns, t0);
+	  c->AtomLine(ad, this);
+	  lap(stats.callback_ns, t0);
+	}
+      }
+      map_pos= next_pos;
+    }
+    //when we hit the end of the file, we've also read a new timestep
+    if(f) {
+      return FinishFrame(*f, lines, row);
+    }
+    c->EndOfTimestep(this);
+    return true;
+  }
+
+  bool LAMMPSReader::ParseAtomsParallel(Frame& f, size_t& pos, size_t& rows) {
+    //the n_atoms lines starting at pos are split into one chunk per thread,
+    //on line boundaries, and the chunks are parsed at the same time
+    //pos is left at the end of the atoms, and rows is set to the number kept by the filters
+    const char *end= map_begin + map_size;
+    const char *p= map_begin + pos;
+    size_t n= f.size();
+    size_t per= (n + threads - 1) / threads;
+    std::vector<const char*> starts;
+    for(size_t i= 0; i < n; ) {
+      const char *nl= (p < end) ? static_cast<const char*>(memchr(p, '\n', end - p)) : NULL;
+      if(!nl && (p == end || i + 1 < n)) {
+	std::cerr << "ERROR: The file ended part way through the atoms of timestep " << last_tstep << ". (" << curfile << ")" << std::endl;
+	return false;
+      }
+      //blank lines aren't atoms, as in ReadMappedFrame(), so they're left out of the count
+      const char *q= p;
+      const char *tb, *te;
+      if(next_token(q, nl ? nl : end, tb, te)) {
+	if(i % per == 0) {
+	  starts.push_back(p);
+	}
+	i++;
+      }
+      p= nl ? nl + 1 : end;
+    }
+    starts.push_back(p);
+    int nchunks= starts.size() - 1;
+    //the first bad line found by each thread, if any, and whether it had too few columns or a value which wasn't a number
+    std::vector<size_t> bad(nchunks, n);
+    std::vector<char> bad_number(nchunks, 0);
+    //each thread writes the atoms it keeps from the start of its own range of rows
+    std::vector<size_t> kept(nchunks, 0);
+    size_t limit= filters.empty() ? std::numeric_limits<size_t>::max() : filter_span;
+    run_parallel(nchunks, [&](int t) {
+      std::vector<Token> toks;
+      size_t row= t*per;
+      size_t out= t*per;
+      for(const char *line= starts[t]; line < starts[t+1]; ) {
+	const char *eol= static_cast<const char*>(memchr(line, '\n', starts[t+1] - line));
+	if(!eol) {
+	  eol= starts[t+1];
+	}
+	toks.clear();
+	Token tok;
+	const char *q= line;
+	line= eol + 1;
+	while(toks.size() < limit && next_token(q, eol, tok.begin, tok.end)) {
+	  toks.push_back(tok);
+	}
+	if(toks.empty()) {
+	  //a blank line, which wasn't counted as an atom
+	  continue;
+	}
+	size_t atom= row++;
+	int pass= (toks.size() == limit) ? filterAtom(toks) : 1;
+	if(pass < 0) {
+	  bad[t]= atom;
+	  bad_number[t]= 1;
+	  return;
+	} else if(pass == 0) {
+	  continue;
+	}
+	while(next_token(q, eol, tok.begin, tok.end)) {
+	  toks.push_back(tok);
+	}
+	if(toks.size() != plan_columns) {
+	  bad[t]= atom;
+	  return;
+	}
+	if(!applyPlan(f, out++, toks)) {
+	  bad[t]= atom;
+	  bad_number[t]= 1;
+	  return;
+	}
+      }
+      kept[t]= out - t*per;
+    });
+    for(int t= 0; t < nchunks; t++) {
+      if(bad[t] < n && bad_number[t]) {
+	std::cerr << "ERROR: Atom " << bad[t] + 1 << " of timestep " << last_tstep << " has a value which isn't a number, or doesn't fit. (" << curfile << ")" << std::endl;
+	return false;
+      } else if(bad[t] < n) {
+	std::cerr << "ERROR: Mismatch between the number of columns reported and the number of columns read, in atom " << bad[t] + 1 << " of timestep " << last_tstep << ". The LAMMPS header lines indicate " << plan_columns << " columns. (" << curfile << ")" << std::endl;
+	return false;
+      }
+    }
+    //close up the gaps the filters left between the threads' rows
+    rows= kept[0];
+    for(int t= 1; t < nchunks; t++) {
+      if(rows < t*per) {
+	for(std::vector<PlanEntry>::const_iterator it= plan.begin(); it < plan.end(); it++) {
+	  if(it->icol) {
+	    std::vector<int>& col= f.*(it->icol);
+	    std::copy(col.begin() + t*per, col.begin() + t*per + kept[t], col.begin() + rows);
+	  } else {
+	    std::vector<double>& col= f.*(it->dcol);
+	    std::copy(col.begin() + t*per, col.begin() + t*per + kept[t], col.begin() + rows);
+	  }
+	}
+      }
+      rows+= kept[t];
+    }
+    pos= p - map_begin;
+    return true;
+  }
+
+  bool LAMMPSReader::ReadBinaryHeader(FrameInfo& fi, int& size_one, int& nprocs) {
+    fi.offset= file.tellg();
     file.read(ubi.buf, sizeof(int64_t));
     //we do a quick check here to make sure that we haven't hit the end of the file
     if(file.fail()) {
       return false;
     }
-    last_tstep= static_cast<int>(ubi.i);
+    fi.timestep= ubi.i;
     
     file.read(ubi.buf, sizeof(int64_t));
-    n_atoms= static_cast<int>(ubi.i);
+    fi.n_atoms= ubi.i;
     
     file.read(ui.buf, sizeof(int));
     if(ui.i) {
@@ -275,56 +954,31 @@ namespace LAMMPSReaderNS {
     }
     
     for(int i= 0; i < 3; i++) {
-      file.read(ui.buf, sizeof(int));
-      if(ui.i == 0) {
-	boundaries[i][0]= 'p';
-      } else if(ui.i == 1) {
-	boundaries[i][0]= 'f';
-      } else if(ui.i == 2) {
-	boundaries[i][0]= 's';
-      } else if(ui.i == 3) {
-	boundaries[i][0]= 'm';
-      }
-      file.read(ui.buf, sizeof(int));
-      if(ui.i == 0) {
-	boundaries[i][1]= 'p';
-      } else if(ui.i == 1) {
-	boundaries[i][1]= 'f';
-      } else if(ui.i == 2) {
-	boundaries[i][1]= 's';
-      } else if(ui.i == 3) {
-	boundaries[i][1]= 'm';
+      for(int j= 0; j < 2; j++) {
+	//anything we don't recognise stays as u, for unset
+	fi.boundaries[i][j]= 'u';
+	file.read(ui.buf, sizeof(int));
+	if(ui.i == 0) {
+	  fi.boundaries[i][j]= 'p';
+	} else if(ui.i == 1) {
+	  fi.boundaries[i][j]= 'f';
+	} else if(ui.i == 2) {
+	  fi.boundaries[i][j]= 's';
+	} else if(ui.i == 3) {
+	  fi.boundaries[i][j]= 'm';
+	}
       }
     }
     
-    double box[6];
-    for(int i= 0; i < 6; i++) {
+    for(int i= 0; i < 3; i++) {
       file.read(ud.buf, sizeof(double));
-      box[i]= ud.d;
-    }
-    box_lo[0]= box[0];
-    box_lo[1]= box[2];
-    box_lo[2]= box[4];
-    box_hi[0]= box[1];
-    box_hi[1]= box[3];
-    box_hi[2]= box[5];
-    
-    file.read(ui.buf, sizeof(int));
-    unsigned int fields_per_atom= ui.i;
-    if(fields_per_atom != args.size()) {
-      std::cerr << "ERROR: LAMMPSReader was told to expect " << args.size() << " fields per atom from the binary file, but the file reports that there are " << fields_per_atom << ". Remember that when reading binary files, the argument passed to ReadFrame() must specify EVERY field in the dump file." << std::endl;
-      return false;
+      fi.box_lo[i]= ud.d;
+      file.read(ud.buf, sizeof(double));
+      fi.box_hi[i]= ud.d;
     }
     
-    property *fields= new property[fields_per_atom];
-    for(unsigned int i= 0; i < args.size(); i++) {
-      fields[i]= string_to_property(args[i]);
-      if(fields[i] == NULL_PROPERTY) {
-	std::cerr << "ERROR: LAMMPSReader doesn't know what to do with the property " << args[i] << std::endl;
-	delete[] fields;
-	return false;
-      }
-    }
+    file.read(ui.buf, sizeof(int));
+    size_one= ui.i;
     
     //Atom data comes in processor blocks!
     //we get the number of processors first
@@ -334,247 +988,1448 @@ namespace LAMMPSReaderNS {
     //then the data from proc 2
     //etc.
     file.read(ui.buf, sizeof(int)); //the number of processors used.
-    int nprocs= ui.i;
+    nprocs= ui.i;
     
     //check that we haven't flagged any errors in the file
     if(file.fail()) {
       std::cerr << "ERROR: LAMMPSReader encountered an error when reading the binary file. This suggests that either your binary file is corrupted, or is of a different format. The LAMMPSReader README file explains the format that it expects to encounter." << std::endl;
       return false;
     }
-    
-    //if that's fine, handle the start of timestep and box hooks
-    c->StartOfTimestep(this);
-    c->BoxBounds(boundaries, box_lo, box_hi);
+    return true;
+  }
+
+  bool LAMMPSReader::ReadBinaryFrame(const std::vector<std::string>& args, Callback* c, Frame *f) {
+    FrameInfo fi;
+    int size_one, nprocs;
+    std::streampos frame_start= collect_stats ? file.tellg() : std::streampos(0);
+    int64_t t0= startLap();
+    if(!ReadBinaryHeader(fi, size_one, nprocs)) {
+      return false;
+    }
+    last_tstep= fi.timestep;
+    n_atoms= static_cast<int>(fi.n_atoms);
+    memcpy(boundaries, fi.boundaries, sizeof(boundaries));
+    for(int i= 0; i < 3; i++) {
+      box_lo[i]= fi.box_lo[i];
+      box_hi[i]= fi.box_hi[i];
+    }
+    
+    unsigned int fields_per_atom= size_one;
+    //without a column layout, the columns are exactly the properties we were given
+    const std::vector<std::string>& columns= binary_columns.empty() ? args : binary_columns;
+    if(fields_per_atom != columns.size()) {
+      if(binary_columns.empty()) {
+	std::cerr << "ERROR: LAMMPSReader was told to expect " << args.size() << " fields per atom from the binary file, but the file reports that there are " << fields_per_atom << ". Remember that when reading binary files, the argument passed to ReadFrame() must specify EVERY field in the dump file, unless they have been given to SetBinaryColumns()." << std::endl;
+      } else {
+	std::cerr << "ERROR: SetBinaryColumns() was given " << columns.size() << " columns, but the binary file reports that there are " << fields_per_atom << " fields per atom. (" << curfile << ")" << std::endl;
+      }
+      return false;
+    }
+    
+    //only the requested columns are ever decoded; the rest of each block is left alone
+    if(!CompilePlan(args, columns)) {
+      return false;
+    }
+    
+    //if that's fine, handle the start of timestep and box hooks
+    if(f) {
+      PrepareFrame(*f);
+    } else {
+      c->StartOfTimestep(this);
+      c->BoxBounds(boundaries, box_lo, box_hi);
+    }
     int atoms_total= 0;
-    AtomData ad;
-    memset(&ad, 0, sizeof(AtomData));
+    //the number of atoms which passed the filters
+    size_t atoms_kept= 0;
+    size_t stride= fields_per_atom*sizeof(double);
+    //big frames are read whole, and then decoded by several threads
+    bool parallel= f && threads > 1 && n_atoms >= parallel_threshold;
+    if(parallel) {
+      block_buf.resize(static_cast<size_t>(n_atoms)*stride);
+    }
     for(int i= 0; i < nprocs; i++) {
       file.read(ui.buf, sizeof(int)); //buffer size per atom.
       int bufsize= ui.i;
-      unsigned int field= 0;
-      for(int j= 0; j < bufsize; j++) {
-	file.read(ud.buf, sizeof(double));
-	double val= ud.d;
-	int ival= static_cast<int>(ud.d);
-	
-	switch(fields[field]) {
-	  case ID:
-	    ad.id= ival;
-	    break;
-	  case TYPE:
-	    ad.type= ival;
-	    break;
-	  case MOL:
-	    ad.mol= ival;
-	    break;
-	  case MASS:
-	    ad.mass= val;
-	    break;
-	  case X:
-	    ad.x= val;
-	    if(wrap && boundaries[0][0] == 'p' && ad.x < box_lo[0]) {
-	      ad.x+= (box_hi[0] - box_lo[0]);
-	    } else if(wrap && boundaries[0][1] == 'p' && ad.x >= box_hi[0]) {
-	      ad.x-= (box_hi[0] - box_lo[0]);
-	    }
-	    break;
-	  case Y:
-	    ad.y= val;
-	    if(wrap && boundaries[1][0] == 'p' && ad.y < box_lo[1]) {
-	      ad.y+= (box_hi[1] - box_lo[1]);
-	    } else if(wrap && boundaries[1][1] == 'p' && ad.y >= box_hi[1]) {
-	      ad.y-= (box_hi[1] - box_lo[1]);
-	    }
-	    break;
-	  case Z:
-	    ad.z= val;
-	    if(wrap && boundaries[2][0] == 'p' && ad.z < box_lo[2]) {
-	      ad.z+= (box_hi[2] - box_lo[2]);
-	    } else if(wrap && boundaries[2][1] == 'p' && ad.z >= box_hi[2]) {
-	      ad.z-= (box_hi[2] - box_lo[2]);
-	    }
-	    break;
-	  case XS:
-	    ad.xs= val;
-	    if(wrap && boundaries[0][0] == 'p' && ad.xs < 0.0) {
-	      ad.xs+= 1.0;
-	    } else if(wrap && boundaries[0][1] == 'p' && ad.xs >= 1.0) {
-	      ad.xs-= 1.0;
-	    }
-	    break;
-	  case YS:
-	    ad.ys= val;
-	    if(wrap && boundaries[1][0] == 'p' && ad.ys < 0.0) {
-	      ad.ys+= 1.0;
-	    } else if(wrap && boundaries[1][1] == 'p' && ad.ys >= 1.0) {
-	      ad.ys-= 1.0;
-	    }
-	    break;
-	  case ZS:
-	    ad.zs= val;
-	    if(wrap && boundaries[2][0] == 'p' && ad.zs < 0.0) {
-	      ad.zs+= 1.0;
-	    } else if(wrap &&boundaries[2][1] == 'p' && ad.zs >= 1.0) {
-	      ad.zs-= 1.0;
-	    }
-	    break;
-	  case XU:
-	    ad.xu= val;
-	    break;
-	  case YU:
-	    ad.yu= val;
-	    break;
-	  case ZU:
-	    ad.zu= val;
-	    break;
-	  case XSU:
-	    ad.xsu= val;
-	    break;
-	  case YSU:
-	    ad.ysu= val;
-	    break;
-	  case ZSU:
-	    ad.zsu= val;
-	    break;
-	  case IX:
-	    ad.ix= ival;
-	    break;
-	  case IY:
-	    ad.iy= ival;
-	    break;
-	  case IZ:
-	    ad.iz= ival;
-	    break;
-	  case VX:
-	    ad.vx= val;
-	    break;
-	  case VY:
-	    ad.vy= val;
-	    break;
-	  case VZ:
-	    ad.vz= val;
-	    break;
-	  case FX:
-	    ad.fx= val;
-	    break;
-	  case FY:
-	    ad.fy= val;
-	    break;
-	  case FZ:
-	    ad.fz= val;
-	    break;
-	  case MUX:
-	    ad.mux= val;
-	    break;
-	  case MUY:
-	    ad.muy= val;
-	    break;
-	  case MUZ:
-	    ad.muz= val;
-	    break;
-	  case MU:
-	    ad.mu= val;
-	    break;
-	  case Q:
-	    ad.q= val;
-	    break;
-	  case NULL_PROPERTY:
-	    //we can't, but we include it for completeness
-	    delete[] fields;
-	    return false;
-	    break;
+      if(bufsize < 0 || static_cast<unsigned int>(bufsize) % fields_per_atom != 0) {
+	std::cerr << "ERROR: A processor block in timestep " << last_tstep << " holds " << bufsize << " values, which isn't a whole number of atoms with " << fields_per_atom << " fields each. (" << curfile << ")" << std::endl;
+	return false;
+      }
+      if(parallel) {
+	size_t natoms= bufsize / fields_per_atom;
+	if(atoms_total + natoms > f->size()) {
+	  std::cerr << "Error: timestep " << last_tstep << " holds more atoms than the " << n_atoms << " in its header! (" << curfile << ")" << std::endl;
+	  return false;
 	}
-	
-	if(++field == fields_per_atom) {
-	  c->AtomLine(ad, this);
-	  memset(&ad, 0, sizeof(AtomData));
-	  atoms_total++;
-	  field= 0;
+	//data() rather than [], as an empty last block starts one past the end
+	file.read(block_buf.data() + atoms_total*stride, natoms*stride);
+	if(file.fail()) {
+	  std::cerr << "ERROR: The file ended part way through timestep " << last_tstep << ". (" << curfile << ")" << std::endl;
+	  return false;
 	}
+	atoms_total+= static_cast<int>(natoms);
+	continue;
+      }
+      //read the whole block in one go
+      block_buf.resize(static_cast<size_t>(bufsize)*sizeof(double));
+      file.read(block_buf.data(), block_buf.size());
+      if(file.fail()) {
+	std::cerr << "ERROR: The file ended part way through timestep " << last_tstep << ". (" << curfile << ")" << std::endl;
+	return false;
+      }
+      lap(stats.io_ns, t0);
+      //then decode it a column at a time
+      //with filters, the atoms to keep are found first, and only they are decoded
+      size_t natoms= bufsize / fields_per_atom;
+      size_t nkeep= natoms;
+      const uint32_t *sel= NULL;
+      if(!filters.empty()) {
+	nkeep= selectAtoms(block_buf.data(), fields_per_atom, natoms, block_mask, block_sel);
+	sel= block_sel.data();
       }
+      if(f) {
+	if(atoms_total + natoms > f->size()) {
+	  std::cerr << "Error: timestep " << last_tstep << " holds more atoms than the " << n_atoms << " in its header! (" << curfile << ")" << std::endl;
+	  return false;
+	}
+	if(nkeep > 0) {
+	  decodeBlock(block_buf.data(), fields_per_atom, nkeep, *f, atoms_kept, sel);
+	}
+	lap(stats.convert_ns, t0);
+	atoms_total+= static_cast<int>(natoms);
+	atoms_kept+= nkeep;
+	continue;
+      }
+      //the atoms are decoded and handed over a chunk at a time, so a big block is never
+      //expanded into AtomData all at once
+      for(size_t done= 0; done < nkeep; done+= block_chunk) {
+	size_t n= std::min(block_chunk, nkeep - done);
+	block_atoms.resize(n);
+	memset(&block_atoms[0], 0, n*sizeof(AtomData));
+	if(sel) {
+	  decodeBlock(block_buf.data(), fields_per_atom, n, &block_atoms[0], sel + done);
+	} else {
+	  decodeBlock(block_buf.data() + done*stride, fields_per_atom, n, &block_atoms[0]);
+	}
+	lap(stats.convert_ns, t0);
+	for(size_t j= 0; j < n; j++) {
+	  c->AtomLine(block_atoms[j], this);
+	}
+	lap(stats.callback_ns, t0);
+      }
+      atoms_total+= static_cast<int>(natoms);
     }
     
     if(atoms_total != n_atoms) {
       std::cerr << "Error: total number of atoms provided by the file (" << atoms_total << ") doesn't match the number in the header (" << n_atoms << ")!" << std::endl;
-      delete[] fields;
       return false;
     }
+
+    if(parallel) {
+      lap(stats.io_ns, t0);
+      //each thread decodes a contiguous range of atoms
+      size_t per= (atoms_total + threads - 1) / threads;
+      const char *buf= block_buf.data();
+      if(filters.empty()) {
+	run_parallel(threads, [&](int t) {
+	  size_t first= t*per;
+	  size_t last= std::min(first + per, static_cast<size_t>(atoms_total));
+	  if(first < last) {
+	    decodeBlock(buf + first*stride, fields_per_atom, last - first, *f, first);
+	  }
+	});
+	atoms_kept= atoms_total;
+      } else {
+	//the threads first select their atoms, then, knowing where each thread's
+	//atoms will start in the frame, decode them
+	std::vector<std::vector<uint32_t> > sels(threads);
+	std::vector<size_t> kept(threads, 0);
+	run_parallel(threads, [&](int t) {
+	  size_t first= t*per;
+	  size_t last= std::min(first + per, static_cast<size_t>(atoms_total));
+	  if(first < last) {
+	    std::vector<unsigned char> mask;
+	    kept[t]= selectAtoms(buf + first*stride, fields_per_atom, last - first, mask, sels[t]);
+	  }
+	});
+	std::vector<size_t> out(threads, 0);
+	for(int t= 0; t < threads; t++) {
+	  out[t]= atoms_kept;
+	  atoms_kept+= kept[t];
+	}
+	run_parallel(threads, [&](int t) {
+	  if(kept[t] > 0) {
+	    decodeBlock(buf + t*per*stride, fields_per_atom, kept[t], *f, out[t], sels[t].data());
+	  }
+	});
+      }
+      lap(stats.convert_ns, t0);
+    }
+    if(collect_stats) {
+      stats.bytes+= file.tellg() - frame_start;
+    }
     
     //if we made it this far, do the end of timestep hook
+    if(f) {
+      return FinishFrame(*f, atoms_total, atoms_kept);
+    }
     c->EndOfTimestep(this);
-    
-    delete[] fields;
     return true;
   }
-  
-  LAMMPSReader::property LAMMPSReader::string_to_property(const std::string& s) {
-    #define AddProperty(prop, str) if(s.compare(str) == 0) { return prop; }
-    AddProperty(ID, "id");
-    AddProperty(TYPE, "type");
-    AddProperty(MOL, "mol");
-    AddProperty(MASS, "mass");
-    AddProperty(X, "x");
-    AddProperty(Y, "y");
-    AddProperty(Z, "z");
-    AddProperty(XS, "xs");
-    AddProperty(YS, "ys");
-    AddProperty(ZS, "zs");
-    AddProperty(XU, "xu");
-    AddProperty(YU, "yu");
-    AddProperty(ZU, "zu");
-    AddProperty(XSU, "xsu");
-    AddProperty(YSU, "ysu");
-    AddProperty(ZSU, "zsu");
-    AddProperty(IX, "ix");
-    AddProperty(IY, "iy");
-    AddProperty(IZ, "iz");
-    AddProperty(VX, "vx");
-    AddProperty(VY, "vy");
-    AddProperty(VZ, "vz");
-    AddProperty(FX, "fx");
-    AddProperty(FY, "fy");
-    AddProperty(FZ, "fz");
-    AddProperty(Q, "q");
-    AddProperty(MUX, "mux");
-    AddProperty(MUY, "muy");
-    AddProperty(MUZ, "muz");
-    AddProperty(MU, "mu");
-    return NULL_PROPERTY;
-  }
-
-
-
-  bool LAMMPSReader::updateAtomData(AtomData& ad, const std::string& prop, const std::string& val) {
-    #define Assign(tag,conv) if(prop.compare(#tag) == 0) { ad.tag= conv(val.c_str()); return true; }
-    Assign(id, atoi)
-    Assign(type, atoi)
-    Assign(mol, atoi)
-    Assign(mass, atof)
-    Assign(x, atof)
-    Assign(y, atof)
-    Assign(z, atof)
-    Assign(xs, atof)
-    Assign(ys, atof)
-    Assign(zs, atof)
-    Assign(xu, atof)
-    Assign(yu, atof)
-    Assign(zu, atof)
-    Assign(xsu, atof)
-    Assign(ysu, atof)
-    Assign(zsu, atof)
-    Assign(ix, atoi)
-    Assign(iy, atoi)
-    Assign(iz, atoi)
-    Assign(vx, atof)
-    Assign(vy, atof)
-    Assign(vz, atof)
-    Assign(fx, atof)
-    Assign(fy, atof)
-    Assign(fz, atof)
-    Assign(q, atof)
-    Assign(mux, atof)
-    Assign(muy, atof)
-    Assign(muz, atof)
+
+  //decodes one column of a processor block: n values, each stride bytes after the last
+  //in the block, converted to T and stored dst_stride bytes apart
+  //the wrapping is done with a branch-free select, so that the loop vectorises where it can
+  template<typename T>
+  static void decode_column(const char *src, size_t stride, size_t n, char *dst, size_t dst_stride,
+			    bool wrap_lo, bool wrap_hi, double lo, double hi) {
+    double len= hi - lo;
+    if(!wrap_lo && !wrap_hi) {
+      for(size_t i= 0; i < n; i++) {
+	double v;
+	memcpy(&v, src + i*stride, sizeof(double));
+	*reinterpret_cast<T*>(dst + i*dst_stride)= static_cast<T>(v);
+      }
+    } else {
+      for(size_t i= 0; i < n; i++) {
+	double v;
+	memcpy(&v, src + i*stride, sizeof(double));
+	double up= (wrap_lo && v < lo) ? len : 0.0;
+	double down= (wrap_hi && v >= hi) ? len : 0.0;
+	v+= up - down;
+	*reinterpret_cast<T*>(dst + i*dst_stride)= static_cast<T>(v);
+      }
+    }
+  }
+
+  //as decode_column, but for the n atoms whose indices are listed in sel
+  template<typename T>
+  static void gather_column(const char *src, size_t stride, const uint32_t *sel, size_t n, char *dst, size_t dst_stride,
+			    bool wrap_lo, bool wrap_hi, double lo, double hi) {
+    double len= hi - lo;
+    for(size_t i= 0; i < n; i++) {
+      double v;
+      memcpy(&v, src + sel[i]*stride, sizeof(double));
+      double up= (wrap_lo && v < lo) ? len : 0.0;
+      double down= (wrap_hi && v >= hi) ? len : 0.0;
+      v+= up - down;
+      *reinterpret_cast<T*>(dst + i*dst_stride)= static_cast<T>(v);
+    }
+  }
+
+  template<typename T>
+  static void decode_or_gather(const char *src, size_t stride, const uint32_t *sel, size_t n, char *dst, size_t dst_stride,
+			       bool wrap_lo, bool wrap_hi, double lo, double hi) {
+    if(sel) {
+      gather_column<T>(src, stride, sel, n, dst, dst_stride, wrap_lo, wrap_hi, lo, hi);
+    } else {
+      decode_column<T>(src, stride, n, dst, dst_stride, wrap_lo, wrap_hi, lo, hi);
+    }
+  }
+
+  void LAMMPSReader::decodeBlock(const char *buf, size_t fields_per_atom, size_t natoms, Frame& f, size_t row, const uint32_t *sel) {
+    //as below, but into the frame's arrays, which are contiguous
+    size_t stride= fields_per_atom*sizeof(double);
+    for(std::vector<PlanEntry>::const_iterator it= plan.begin(); it < plan.end(); it++) {
+      const char *src= buf + it->column*sizeof(double);
+      if(it->icol) {
+	char *dst= reinterpret_cast<char*>(&(f.*(it->icol))[row]);
+	decode_or_gather<int>(src, stride, sel, natoms, dst, sizeof(int), false, false, 0.0, 0.0);
+      } else {
+	char *dst= reinterpret_cast<char*>(&(f.*(it->dcol))[row]);
+	decode_or_gather<double>(src, stride, sel, natoms, dst, sizeof(double), it->wrap_lo, it->wrap_hi, it->lo, it->hi);
+      }
+    }
+  }
+
+  void LAMMPSReader::decodeBlock(const char *buf, size_t fields_per_atom, size_t natoms, AtomData *atoms, const uint32_t *sel) {
+    //natoms atoms are decoded: the first natoms in buf, or the ones listed in sel
+    size_t stride= fields_per_atom*sizeof(double);
+    for(std::vector<PlanEntry>::const_iterator it= plan.begin(); it < plan.end(); it++) {
+      const char *src= buf + it->column*sizeof(double);
+      if(it->islot) {
+	char *dst= reinterpret_cast<char*>(&(atoms[0].*(it->islot)));
+	decode_or_gather<int>(src, stride, sel, natoms, dst, sizeof(AtomData), false, false, 0.0, 0.0);
+      } else {
+	char *dst= reinterpret_cast<char*>(&(atoms[0].*(it->dslot)));
+	decode_or_gather<double>(src, stride, sel, natoms, dst, sizeof(AtomData), it->wrap_lo, it->wrap_hi, it->lo, it->hi);
+      }
+    }
+  }
+
+  const char* FieldName(Field f) {
+    return property_slots[f].name;
+  }
+
+  bool LAMMPSReader::tokenInt(const Token& t, int& v) {
+    return ParseInt(t.begin, t.end, v);
+  }
+
+  bool LAMMPSReader::tokenDouble(const Token& t, double& v) {
+    return ParseDouble(t.begin, t.end, v);
+  }
+
+  bool LAMMPSReader::beginFrame(const Field *fields, size_t nfields) {
+    //reads the header of the next frame for ReadFrame<...>(), and compiles the plan for its fields
+    if(!file.is_open()) {
+      std::cerr << "LAMMPSReader::ReadFrame() called while no file is open." << std::endl;
+      return false;
+    }
+    if(id_order) {
+      std::cerr << "ERROR: id_order can't be used with ReadFrame<...>(), which hands over the atoms as they're read. (" << curfile << ")" << std::endl;
+      return false;
+    }
+    frame_start_ns= startLap();
+    frame_end= -1;
+    if(follow) {
+      if(!followFrame()) {
+	return false;
+      }
+    } else if(pending_skip > 0) {
+      if(!SkipFrames(0)) {
+	return false;
+      }
+    }
+    if(pastRange()) {
+      return false;
+    }
+    field_args.resize(nfields);
+    for(size_t i= 0; i < nfields; i++) {
+      field_args[i]= FieldName(fields[i]);
+    }
+    FrameInfo fi;
+    if(binary) {
+      if(binary_columns.empty()) {
+	std::cerr << "ERROR: ReadFrame<...>() needs the columns of a binary file to be given to SetBinaryColumns() first. (" << curfile << ")" << std::endl;
+	return false;
+      }
+      int size_one;
+      if(!ReadBinaryHeader(fi, size_one, blocks_left)) {
+	return false;
+      }
+      if(static_cast<size_t>(size_one) != binary_columns.size()) {
+	std::cerr << "ERROR: SetBinaryColumns() was given " << binary_columns.size() << " columns, but the binary file reports that there are " << size_one << " fields per atom. (" << curfile << ")" << std::endl;
+	return false;
+      }
+    } else {
+      if(mapped) {
+	//the header is read through the stream, and the atoms straight from the mapping
+	file.clear();
+	file.seekg(map_pos);
+      }
+      if(scanTextHeader(fi, true) != 1) {
+	if(mapped) {
+	  map_pos= map_size;
+	}
+	return false;
+      }
+      if(mapped) {
+	map_pos= file.tellg();
+      }
+    }
+    last_tstep= fi.timestep;
+    n_atoms= static_cast<int>(fi.n_atoms);
+    memcpy(boundaries, fi.boundaries, sizeof(boundaries));
+    for(int i= 0; i < 3; i++) {
+      box_lo[i]= fi.box_lo[i];
+      box_hi[i]= fi.box_hi[i];
+    }
+    frame_atoms= 0;
+    return CompilePlan(field_args, binary ? binary_columns : avail_columns);
+  }
+
+  int LAMMPSReader::nextAtomLine() {
+    //tokenizes the next atom line of a text frame
+    //returns 1 if the atom is wanted, 0 if it was filtered out, and -1 on error
+    const char *b, *e;
+    if(mapped) {
+      if(map_pos >= map_size) {
+	std::cerr << "ERROR: The file ended part way through the atoms of timestep " << last_tstep << ". (" << curfile << ")" << std::endl;
+	return -1;
+      }
+      b= map_begin + map_pos;
+      const char *nl= static_cast<const char*>(memchr(b, '\n', map_size - map_pos));
+      e= nl ? nl : map_begin + map_size;
+      map_pos= nl ? (nl - map_begin) + 1 : map_size;
+    } else {
+      if(!std::getline(file, line_buf)) {
+	std::cerr << "ERROR: The file ended part way through the atoms of timestep " << last_tstep << ". (" << curfile << ")" << std::endl;
+	return -1;
+      }
+      b= line_buf.data();
+      e= b + line_buf.size();
+    }
+    tokens.clear();
+    Token t;
+    while(next_token(b, e, t.begin, t.end)) {
+      tokens.push_back(t);
+    }
+    if(tokens.size() != plan_columns) {
+      std::cerr << "ERROR: Mismatch between the number of columns reported and the number of columns read. The LAMMPS header lines indicate " << plan_columns << " columns, but only " << tokens.size() << " were read. (" << curfile << ")" << std::endl;
+      return -1;
+    }
+    frame_atoms++;
+    int pass= filters.empty() ? 1 : filterAtom(tokens);
+    if(pass < 0) {
+      badNumber(tokens);
+    }
+    return pass;
+  }
+
+  bool LAMMPSReader::nextBlock(size_t& natoms, const uint32_t*& sel) {
+    //reads the next processor block of a binary frame into block_buf
+    //natoms is set to the number of atoms to decode, and sel to their rows, or NULL for all of them
+    blocks_left--;
+    file.read(ui.buf, sizeof(int));
+    int bufsize= ui.i;
+    if(file.fail() || bufsize < 0 || static_cast<size_t>(bufsize) % plan_columns != 0) {
+      std::cerr << "ERROR: A processor block in timestep " << last_tstep << " is damaged, or isn't a whole number of atoms with " << plan_columns << " fields each. (" << curfile << ")" << std::endl;
+      return false;
+    }
+    block_buf.resize(static_cast<size_t>(bufsize)*sizeof(double));
+    file.read(block_buf.data(), block_buf.size());
+    if(file.fail()) {
+      std::cerr << "ERROR: The file ended part way through timestep " << last_tstep << ". (" << curfile << ")" << std::endl;
+      return false;
+    }
+    natoms= bufsize / plan_columns;
+    frame_atoms+= natoms;
+    sel= NULL;
+    if(!filters.empty()) {
+      natoms= selectAtoms(block_buf.data(), plan_columns, natoms, block_mask, block_sel);
+      sel= block_sel.data();
+    }
+    return true;
+  }
+
+  bool LAMMPSReader::endFrame() {
+    if(frame_atoms != n_atoms) {
+      std::cerr << "ERROR: Timestep " << last_tstep << " contains " << frame_atoms << " atoms, but its header says there should be " << n_atoms << ". (" << curfile << ")" << std::endl;
+      return false;
+    }
+    if(collect_stats) {
+      stats.frames++;
+      stats.atoms+= n_atoms;
+      stats.total_ns+= now_ns() - frame_start_ns;
+    }
+    if(stride > 1) {
+      pending_skip= stride - 1;
+    }
+    return true;
+  }
+
+  bool LAMMPSReader::followFrame() {
+    //waits for the next frame to be read, and any the stride skips before it, to be written in full
+    //leaves the reader at the start of the frame, with frame_end set to where it ends
+    if(decompressor || readahead) {
+      std::cerr << "ERROR: follow can't be used with a compressed file, or with EnablePrefetch(). (" << curfile << ")" << std::endl;
+      return false;
+    }
+    size_t skip= pending_skip;
+    pending_skip= 0;
+    int64_t start;
+    for(size_t i= 0; i <= skip; i++) {
+      if(!waitForFrame(start, frame_end)) {
+	return false;
+      }
+      //seekTo() leaves the reader where the next frame starts
+      seekTo(i < skip ? frame_end : start);
+    }
+    return true;
+  }
+
+  bool LAMMPSReader::waitForFrame(int64_t& start, int64_t& end) {
+    //waits until the frame at the reader's position is complete, and finds where it ends
+    file.clear();
+    start= mapped ? static_cast<int64_t>(map_pos) : static_cast<int64_t>(file.tellg());
+    while(true) {
+      //the size is taken first, so that anything written while checking the frame isn't missed
+      int64_t seen= fileSize();
+      if(mapped && seen > static_cast<int64_t>(map_size) && !remapFile(seen)) {
+	return false;
+      }
+      int status= frameComplete(start, end);
+      if(status == 1) {
+	return true;
+      }
+      if(!waitForGrowth(seen)) {
+	return false;
+      }
+    }
+  }
+
+  int LAMMPSReader::frameComplete(int64_t start, int64_t& end) {
+    //returns 1 if the frame at start has been written in full, setting end to where it finishes,
+    //or 0 if it hasn't (yet); nothing is said about a frame which is only partly there
+    //a damaged frame counts as complete, so that reading it reports what's wrong
+    file.clear();
+    file.seekg(start);
+    if(binary) {
+      int64_t size= fileSize();
+      int64_t pos= start + 2*sizeof(int64_t);
+      file.seekg(pos);
+      file.read(ui.buf, sizeof(int));
+      //the boundaries and box, the tilt factors of a triclinic box, then size_one and nprocs
+      pos+= sizeof(int) + 6*sizeof(int) + 6*sizeof(double) + (ui.i ? 3*sizeof(double) : 0) + sizeof(int);
+      file.seekg(pos);
+      file.read(ui.buf, sizeof(int));
+      int nprocs= ui.i;
+      pos+= sizeof(int);
+      for(int i= 0; i < nprocs && !file.fail() && pos <= size; i++) {
+	file.seekg(pos);
+	file.read(ui.buf, sizeof(int));
+	pos+= sizeof(int) + static_cast<int64_t>(ui.i)*sizeof(double);
+      }
+      if(file.fail() || pos > size) {
+	return 0;
+      }
+      end= pos;
+      return 1;
+    }
+    int64_t natoms= -1;
+    while(std::getline(file, line_buf)) {
+      if(file.eof()) {
+	//the last line hasn't had its newline written yet
+	return 0;
+      }
+      tokenizeLine(line_buf);
+      if(tokens.size() < 2 || !token_is(tokens[0].begin, tokens[0].end, "ITEM:")) {
+	continue;
+      }
+      if(token_is(tokens[1].begin, tokens[1].end, "NUMBER")) {
+	if(!std::getline(file, line_buf) || file.eof()) {
+	  return 0;
+	}
+	if(!ParseInt(line_buf.data(), line_buf.data() + line_buf.size(), natoms)) {
+	  //it'll be reported when the frame is read
+	  natoms= -1;
+	}
+      } else if(token_is(tokens[1].begin, tokens[1].end, "ATOMS")) {
+	if(natoms >= 0 && !skipLines(natoms)) {
+	  return 0;
+	}
+	file.clear();
+	end= file.tellg();
+	return 1;
+      }
+    }
+    return 0;
+  }
+
+  bool LAMMPSReader::waitForGrowth(int64_t seen) {
+    //waits until the file is bigger than seen bytes
+    //returns false if follow_timeout seconds pass first, or if the file gets smaller
+    std::chrono::steady_clock::time_point start= std::chrono::steady_clock::now();
+    while(true) {
+      int64_t size= fileSize();
+      if(size > seen) {
+	return !mapped || remapFile(size);
+      }
+      if(size < seen) {
+	std::cerr << "ERROR: " << curfile << " got smaller while it was being followed, so it must have been rewritten." << std::endl;
+	return false;
+      }
+      if(follow_timeout > 0.0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= follow_timeout) {
+	return false;
+      }
+#ifdef __linux__
+      //inotify wakes us as soon as the file is written to; if it can't be used, follow_fd is
+      //left at -2, and the file is polled instead
+      if(follow_fd == -1) {
+	follow_fd= inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(follow_fd >= 0 && inotify_add_watch(follow_fd, curfile.c_str(), IN_MODIFY) < 0) {
+	  ::close(follow_fd);
+	  follow_fd= -2;
+	} else if(follow_fd < 0) {
+	  follow_fd= -2;
+	}
+      }
+      if(follow_fd >= 0) {
+	struct pollfd pfd;
+	pfd.fd= follow_fd;
+	pfd.events= POLLIN;
+	pfd.revents= 0;
+	if(poll(&pfd, 1, follow_poll_ms) > 0) {
+	  char events[4096];
+	  while(read(follow_fd, events, sizeof(events)) > 0) {
+	  }
+	}
+	continue;
+      }
+#endif
+      std::this_thread::sleep_for(std::chrono::milliseconds(follow_poll_ms));
+    }
+  }
+
+  int64_t LAMMPSReader::fileSize() const {
+    struct stat st;
+    return (stat(curfile.c_str(), &st) == 0) ? static_cast<int64_t>(st.st_size) : -1;
+  }
+
+  bool LAMMPSReader::remapFile(size_t size) {
+    //maps a file which has grown again, at its new size
+    int fd= ::open(curfile.c_str(), O_RDONLY);
+    void *addr= (fd < 0) ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(fd >= 0) {
+      ::close(fd);
+    }
+    if(addr == MAP_FAILED) {
+      std::cerr << "Error! Failed to memory map file " << curfile << std::endl;
+      return false;
+    }
+    if(map_begin) {
+      munmap(const_cast<char*>(map_begin), map_size);
+    }
+    madvise(addr, size, MADV_SEQUENTIAL);
+    map_begin= static_cast<const char*>(addr);
+    map_size= size;
+    return true;
+  }
+
+  int LAMMPSReader::ScanTextFrame(FrameInfo& fi) {
+    //reads the header of the next text frame into fi, then skips over its atoms
+    //returns 1 if a frame was found, 0 at the end of the file and -1 on error
+    int status= scanTextHeader(fi, false);
+    //the atoms are the last thing in a frame, and we don't need to look at them
+    if(status == 1 && !skipLines(fi.n_atoms)) {
+      std::cerr << "ERROR: The file ended part way through the atoms of timestep " << fi.timestep << ". (" << curfile << ")" << std::endl;
+      return -1;
+    }
+    return status;
+  }
+
+  int LAMMPSReader::scanTextHeader(FrameInfo& fi, bool columns) {
+    //reads the header of the next text frame into fi, leaving the stream at its first atom line
+    //if columns is true, the names of the columns are put in avail_columns
+    fi.offset= file.tellg();
+    bool insideTstep= false;
+    while(std::getline(file, line_buf)) {
+      tokenizeLine(line_buf);
+      if(tokens.empty()) {
+	if(!insideTstep) {
+	  fi.offset= file.tellg();
+	}
+	continue;
+      }
+      if(tokens.size() < 2 || !token_is(tokens[0].begin, tokens[0].end, "ITEM:")) {
+	std::cerr << "ERROR: Expected an ITEM: line while indexing, but found: " << std::endl;
+	std::cerr << line_buf << " (" << curfile << ")" << std::endl;
+	return -1;
+      }
+      const Token& item= tokens[1];
+      if(token_is(item.begin, item.end, "TIMESTEP")) {
+	insideTstep= true;
+	if(!std::getline(file, line_buf)) {
+	  std::cerr << "ERROR: Failed to read a timestep after an ITEM: TIMESTEP line. (" << curfile << ")" << std::endl;
+	  return -1;
+	}
+	if(!ParseInt(line_buf.data(), line_buf.data() + line_buf.size(), fi.timestep)) {
+	  std::cerr << "ERROR: Malformed timestep '" << line_buf << "' after an ITEM: TIMESTEP line. (" << curfile << ")" << std::endl;
+	  return -1;
+	}
+      } else if(token_is(item.begin, item.end, "NUMBER")) {
+	if(!std::getline(file, line_buf)) {
+	  std::cerr << "ERROR: Failed to read the number of atoms after an ITEM: NUMBER OF ATOMS line. (" << curfile << ")" << std::endl;
+	  return -1;
+	}
+	if(!ParseInt(line_buf.data(), line_buf.data() + line_buf.size(), fi.n_atoms) || fi.n_atoms < 0) {
+	  std::cerr << "ERROR: Malformed number of atoms '" << line_buf << "' after an ITEM: NUMBER OF ATOMS line. (" << curfile << ")" << std::endl;
+	  return -1;
+	}
+      } else if(token_is(item.begin, item.end, "BOX")) {
+	if(tokens.size() < 6) {
+	  std::cerr << "ERROR: Malformed ITEM: BOX BOUNDS line. Expected 6 tokens, only found " << tokens.size() << ". (" << curfile << ")" << std::endl;
+	  return -1;
+	}
+	for(int i= 0; i < 3; i++) {
+	  fi.boundaries[i][0]= tokens[i+3].begin[0];
+	  fi.boundaries[i][1]= (tokens[i+3].end - tokens[i+3].begin > 1) ? tokens[i+3].begin[1] : '\0';
+	}
+	for(int i= 0; i < 3; i++) {
+	  if(!std::getline(file, line_buf)) {
+	    std::cerr << "ERROR: Unexpected end of file inside the box bounds. (" << curfile << ")" << std::endl;
+	    return -1;
+	  }
+	  tokenizeLine(line_buf);
+	  if(tokens.size() < 2) {
+	    std::cerr << "ERROR: Malformed box bounds line: " << line_buf << " (" << curfile << ")" << std::endl;
+	    return -1;
+	  }
+	  if(!ParseDouble(tokens[0].begin, tokens[0].end, fi.box_lo[i]) || !ParseDouble(tokens[1].begin, tokens[1].end, fi.box_hi[i])) {
+	    std::cerr << "ERROR: Malformed box bounds line: " << line_buf << " (" << curfile << ")" << std::endl;
+	    return -1;
+	  }
+	}
+      } else if(token_is(item.begin, item.end, "ATOMS")) {
+	if(columns) {
+	  setColumns(tokens.begin() + 2, tokens.end());
+	}
+	return 1;
+      }
+    }
+    if(insideTstep) {
+      std::cerr << "ERROR: The file ended part way through the header of timestep " << fi.timestep << ". (" << curfile << ")" << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  bool LAMMPSReader::skipLines(int64_t n) {
+    //moves the stream past n lines, finding the newlines with memchr rather than reading line by line
+    //returns false if the file ends first
+    if(n <= 0) {
+      return true;
+    }
+    if(mapped) {
+      //the bytes are already in memory, so the stream only needs to be told where we ended up
+      file.clear();
+      size_t pos= file.tellg();
+      while(n > 0 && pos < map_size) {
+	const char *nl= static_cast<const char*>(memchr(map_begin + pos, '\n', map_size - pos));
+	if(!nl) {
+	  return false;
+	}
+	pos= nl - map_begin + 1;
+	n--;
+      }
+      file.seekg(pos);
+      return n == 0;
+    }
+    char buf[65536];
+    while(true) {
+      file.read(buf, sizeof(buf));
+      const char *p= buf;
+      const char *e= buf + file.gcount();
+      while(p < e) {
+	const char *nl= static_cast<const char*>(memchr(p, '\n', e - p));
+	if(!nl) {
+	  break;
+	}
+	p= nl + 1;
+	if(--n == 0) {
+	  //hand back whatever was read beyond the last line
+	  file.clear();
+	  file.seekg(-static_cast<std::streamoff>(e - p), std::ios::cur);
+	  return !file.fail();
+	}
+      }
+      if(file.eof() || file.fail()) {
+	return false;
+      }
+    }
+  }
+
+  bool LAMMPSReader::scanFrames(size_t n) {
+    //scans past n frames from the stream's position, keeping the map position in step
+    FrameInfo fi;
+    bool ok= true;
+    for(size_t i= 0; i < n && ok; i++) {
+      ok= (binary ? ScanBinaryFrame(fi) : ScanTextFrame(fi)) == 1;
+    }
+    if(mapped) {
+      file.clear();
+      map_pos= ok ? static_cast<size_t>(file.tellg()) : map_size;
+    }
+    return ok;
+  }
+
+  bool LAMMPSReader::SkipFrames(size_t n) {
+    //moves past the next n frames, reading only their headers
+    //returns false if the file ends (or is damaged) before n frames have been skipped
+    if(!file.is_open()) {
+      std::cerr << "LAMMPSReader::SkipFrames() called while no file is open." << std::endl;
+      return false;
+    }
+    //frames the stride has still to skip come first
+    n+= pending_skip;
+    pending_skip= 0;
+    if(n == 0) {
+      return true;
+    }
+    file.clear();
+    int64_t pos= mapped ? static_cast<int64_t>(map_pos) : static_cast<int64_t>(file.tellg());
+    if(!index.empty()) {
+      //with an index there's nothing to scan: find the frame we're at, and jump
+      std::vector<FrameInfo>::const_iterator it= index.begin();
+      while(it < index.end() && it->offset < pos) {
+	it++;
+      }
+      size_t left= index.end() - it;
+      if(left > n) {
+	return seekTo((it + n)->offset);
+      }
+      if(left == 0) {
+	return false;
+      }
+      //the rest of the frames are skipped, which leaves the reader at the end; that's
+      //only a success if exactly n were left, as it is when scanning
+      seekTo(index.back().offset);
+      return scanFrames(1) && left == n;
+    }
+    if(mapped) {
+      //the scanning functions read the stream, so it's moved to wherever the map is up to
+      file.seekg(pos);
+    }
+    return scanFrames(n);
+  }
+
+  int LAMMPSReader::ScanBinaryFrame(FrameInfo& fi) {
+    //reads the header of the next binary frame into fi, then seeks past the processor blocks
+    //returns 1 if a frame was found, 0 at the end of the file and -1 on error
+    if(file.peek() == std::char_traits<char>::eof()) {
+      return 0;
+    }
+    int size_one, nprocs;
+    if(!ReadBinaryHeader(fi, size_one, nprocs)) {
+      return -1;
+    }
+    for(int i= 0; i < nprocs; i++) {
+      file.read(ui.buf, sizeof(int));
+      file.seekg(static_cast<std::streamoff>(ui.i)*sizeof(double), std::ios::cur);
+    }
+    if(file.fail()) {
+      std::cerr << "ERROR: The file ended part way through timestep " << fi.timestep << ". (" << curfile << ")" << std::endl;
+      return -1;
+    }
+    return 1;
+  }
+
+  std::string LAMMPSReader::sidecarName() const {
+    return curfile + ".lrindex";
+  }
+
+  std::string LAMMPSReader::pointsName() const {
+    return curfile + ".lrzindex";
+  }
+
+  //the sidecar file starts with these 8 bytes, followed by the size and modification
+  //time of the dump file, the binary flag, and then the frame entries
+  static const char index_magic[8]= {'L', 'R', 'I', 'N', 'D', 'E', 'X', '1'};
+
+  bool LAMMPSReader::LoadIndex() {
+    struct stat st;
+    if(stat(curfile.c_str(), &st) != 0) {
+      return false;
+    }
+    std::ifstream in(sidecarName().c_str(), std::ios::binary);
+    if(!in.is_open()) {
+      return false;
+    }
+    char magic[8];
+    int64_t size, mtime, nframes;
+    int bin;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    in.read(reinterpret_cast<char*>(&mtime), sizeof(mtime));
+    in.read(reinterpret_cast<char*>(&bin), sizeof(bin));
+    in.read(reinterpret_cast<char*>(&nframes), sizeof(nframes));
+    //an index for a different version of the file is useless
+    if(in.fail() || memcmp(magic, index_magic, sizeof(magic)) != 0 || size != static_cast<int64_t>(st.st_size) ||
+       mtime != static_cast<int64_t>(st.st_mtime) || bin != static_cast<int>(binary) || nframes < 0) {
+      return false;
+    }
+    std::vector<FrameInfo> entries(nframes);
+    for(int64_t i= 0; i < nframes; i++) {
+      FrameInfo& fi= entries[i];
+      in.read(reinterpret_cast<char*>(&fi.offset), sizeof(fi.offset));
+      in.read(reinterpret_cast<char*>(&fi.timestep), sizeof(fi.timestep));
+      in.read(reinterpret_cast<char*>(&fi.n_atoms), sizeof(fi.n_atoms));
+      in.read(&fi.boundaries[0][0], sizeof(fi.boundaries));
+      in.read(reinterpret_cast<char*>(fi.box_lo), sizeof(fi.box_lo));
+      in.read(reinterpret_cast<char*>(fi.box_hi), sizeof(fi.box_hi));
+    }
+    if(in.fail()) {
+      return false;
+    }
+    index.swap(entries);
+    return true;
+  }
+
+  bool LAMMPSReader::SaveIndex() {
+    struct stat st;
+    if(stat(curfile.c_str(), &st) != 0) {
+      return false;
+    }
+    //written under a name of its own and then renamed, so that readers opening the same
+    //dump at once never see another's half written index
+    std::ostringstream tmp;
+    tmp << sidecarName() << ".tmp" << getpid() << "." << this;
+    std::ofstream out(tmp.str().c_str(), std::ios::binary | std::ios::trunc);
+    if(!out.is_open()) {
+      return false;
+    }
+    int64_t size= st.st_size;
+    int64_t mtime= st.st_mtime;
+    int64_t nframes= index.size();
+    int bin= binary;
+    out.write(index_magic, sizeof(index_magic));
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(reinterpret_cast<const char*>(&mtime), sizeof(mtime));
+    out.write(reinterpret_cast<const char*>(&bin), sizeof(bin));
+    out.write(reinterpret_cast<const char*>(&nframes), sizeof(nframes));
+    for(std::vector<FrameInfo>::const_iterator it= index.begin(); it < index.end(); it++) {
+      out.write(reinterpret_cast<const char*>(&it->offset), sizeof(it->offset));
+      out.write(reinterpret_cast<const char*>(&it->timestep), sizeof(it->timestep));
+      out.write(reinterpret_cast<const char*>(&it->n_atoms), sizeof(it->n_atoms));
+      out.write(&it->boundaries[0][0], sizeof(it->boundaries));
+      out.write(reinterpret_cast<const char*>(it->box_lo), sizeof(it->box_lo));
+      out.write(reinterpret_cast<const char*>(it->box_hi), sizeof(it->box_hi));
+    }
+    out.close();
+    if(out.fail() || rename(tmp.str().c_str(), sidecarName().c_str()) != 0) {
+      remove(tmp.str().c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool LAMMPSReader::BuildIndex(bool use_sidecar) {
+    //records where each frame starts, so that SeekFrame() and SeekTimestep() can jump straight to it
+    //if use_sidecar is true, a previously saved index is reused if it is still valid for this file,
+    //and a freshly built one is saved alongside the dump file for next time
+    if(!file.is_open()) {
+      std::cerr << "LAMMPSReader::BuildIndex() called while no file is open." << std::endl;
+      return false;
+    }
+    if(use_sidecar && LoadIndex()) {
+      return true;
+    }
+    //remember where we were, so that indexing doesn't disturb the reading position
+    file.clear();
+    std::streampos pos= file.tellg();
+    file.seekg(0);
+    index.clear();
+    FrameInfo fi;
+    int status;
+    while((status= (binary ? ScanBinaryFrame(fi) : ScanTextFrame(fi))) == 1) {
+      index.push_back(fi);
+    }
+    file.clear();
+    file.seekg(pos);
+    if(status < 0) {
+      index.clear();
+      return false;
+    }
+    if(use_sidecar && !SaveIndex()) {
+      std::cerr << "WARNING: Failed to save the frame index to " << sidecarName() << ". It will be rebuilt next time." << std::endl;
+    }
+    //indexing has decompressed the whole file, so we now know where decompression can restart
+    struct stat st;
+    if(use_sidecar && decompressor && stat(curfile.c_str(), &st) == 0 && !decompressor->SavePoints(pointsName(), st.st_size, st.st_mtime)) {
+      std::cerr << "WARNING: Failed to save the decompression access points to " << pointsName() << "." << std::endl;
+    }
+    return true;
+  }
+
+  bool LAMMPSReader::ScanHeaders(std::vector<FrameInfo>& table, bool use_sidecar) {
+    //building the index reads exactly the headers, so the table is the index
+    //text atoms are passed over by counting newlines, and binary processor blocks are seeked over
+    table.clear();
+    if(index.empty() && !BuildIndex(use_sidecar)) {
+      return false;
+    }
+    table= index;
+    return true;
+  }
+
+  bool LAMMPSReader::SeekFrame(size_t n) {
+    //positions the file so that the next ReadFrame() reads frame n (counting from zero)
+    if(!file.is_open()) {
+      std::cerr << "LAMMPSReader::SeekFrame() called while no file is open." << std::endl;
+      return false;
+    }
+    if(index.empty() && !BuildIndex()) {
+      return false;
+    }
+    if(n >= index.size()) {
+      std::cerr << "ERROR: Frame " << n << " was requested, but " << curfile << " only contains " << index.size() << " frames." << std::endl;
+      return false;
+    }
+    return seekTo(index[n].offset);
+  }
+
+  bool LAMMPSReader::ShardRange(int nshards, int shard, int64_t& begin, int64_t& end) {
+    if(!file.is_open()) {
+      std::cerr << "LAMMPSReader::ShardRange() called while no file is open." << std::endl;
+      return false;
+    }
+    if(nshards < 1 || shard < 0 || shard >= nshards) {
+      std::cerr << "ERROR: Shard " << shard << " of " << nshards << " was requested. Shards are numbered from 0 to one less than the number of shards. (" << curfile << ")" << std::endl;
+      return false;
+    }
+    return shardBoundary(shard, nshards, begin) && shardBoundary(shard + 1, nshards, end);
+  }
+
+  bool LAMMPSReader::shardBoundary(int k, int nshards, int64_t& at) {
+    //finds where shard k starts, which is also where shard k-1 ends
+    if(binary || decompressor) {
+      //binary frames can't be recognised from the middle of one, and compressed offsets
+      //aren't offsets into the file, so these are split by frame, using the index
+      if(index.empty() && !BuildIndex()) {
+	return false;
+      }
+      size_t frame= index.size()*k/nshards;
+      if(frame < index.size()) {
+	at= index[frame].offset;
+      } else {
+	//a compressed file's decompressed size isn't known, so the last shard runs on to its end
+	at= decompressor ? -1 : fileSize();
+      }
+      return true;
+    }
+    int64_t size= fileSize();
+    if(size < 0) {
+      std::cerr << "Error! Failed to stat file " << curfile << std::endl;
+      return false;
+    }
+    at= size;
+    if(k == 0) {
+      at= 0;
+      return true;
+    }
+    if(k == nshards) {
+      return true;
+    }
+    //every text frame starts with an ITEM: TIMESTEP line, so the shard starts at the first
+    //one after its share of the bytes, which is found by reading from there
+    static const char marker[]= "\nITEM: TIMESTEP";
+    const size_t len= sizeof(marker) - 1;
+    int64_t from= std::max<int64_t>(0, size/nshards*k + (size % nshards)*k/nshards - 1);
+    if(from >= size) {
+      return true;
+    }
+    if(mapped) {
+      const char *p= static_cast<const char*>(memmem(map_begin + from, map_size - from, marker, len));
+      if(p) {
+	at= (p - map_begin) + 1;
+      }
+      return true;
+    }
+    //otherwise the stream is read in pieces, each starting a little before the last one ended,
+    //so that a marker across the join isn't missed
+    file.clear();
+    std::streampos pos= file.tellg();
+    std::vector<char> piece(1 << 16);
+    while(from < size) {
+      file.clear();
+      file.seekg(from);
+      file.read(piece.data(), piece.size());
+      size_t got= file.gcount();
+      const char *p= static_cast<const char*>(memmem(piece.data(), got, marker, len));
+      if(p) {
+	at= from + (p - piece.data()) + 1;
+	break;
+      }
+      if(got < piece.size()) {
+	break;
+      }
+      from+= got - (len - 1);
+    }
+    file.clear();
+    file.seekg(pos);
+    return true;
+  }
+
+  bool LAMMPSReader::SetRange(int64_t begin, int64_t end) {
+    if(!file.is_open()) {
+      std::cerr << "LAMMPSReader::SetRange() called while no file is open." << std::endl;
+      return false;
+    }
+    range_end= end;
+    return seekTo(begin);
+  }
+
+  bool LAMMPSReader::pastRange() {
+    //true if the next frame starts at or after the end given to SetRange()
+    if(range_end < 0) {
+      return false;
+    }
+    if(mapped) {
+      return static_cast<int64_t>(map_pos) >= range_end;
+    }
+    //a stream which has already hit the end is left alone, for the reader to find that out itself
+    if(!file.good()) {
+      return false;
+    }
+    int64_t pos= file.tellg();
+    return pos < 0 || pos >= range_end;
+  }
+
+  bool LAMMPSReader::seekTo(int64_t offset) {
+    pending_skip= 0;
+    file.clear();
+    file.seekg(offset);
+    map_pos= offset;
+    return !file.fail();
+  }
+
+  bool LAMMPSReader::SeekTimestep(int64_t t) {
+    //positions the file so that the next ReadFrame() reads the frame with timestep t
+    if(!file.is_open()) {
+      std::cerr << "LAMMPSReader::SeekTimestep() called while no file is open." << std::endl;
+      return false;
+    }
+    if(index.empty() && !BuildIndex()) {
+      return false;
+    }
+    for(size_t i= 0; i < index.size(); i++) {
+      if(index[i].timestep == t) {
+	return SeekFrame(i);
+      }
+    }
+    std::cerr << "ERROR: Timestep " << t << " was requested, but it doesn't appear in " << curfile << std::endl;
     return false;
   }
+
+  #define IntSlot(tag) {#tag, &AtomData::tag, NULL, &Frame::tag, NULL, -1, false},
+  #define DoubleSlot(tag) {#tag, NULL, &AtomData::tag, NULL, &Frame::tag, -1, false},
+  #define PositionSlot(tag, d, s) {#tag, NULL, &AtomData::tag, NULL, &Frame::tag, d, s},
+  const PropertySlot property_slots[]= {
+    IntSlot(id) IntSlot(type) IntSlot(mol) DoubleSlot(mass)
+    PositionSlot(x, 0, false) PositionSlot(y, 1, false) PositionSlot(z, 2, false)
+    PositionSlot(xs, 0, true) PositionSlot(ys, 1, true) PositionSlot(zs, 2, true)
+    DoubleSlot(xu) DoubleSlot(yu) DoubleSlot(zu) DoubleSlot(xsu) DoubleSlot(ysu) DoubleSlot(zsu)
+    IntSlot(ix) IntSlot(iy) IntSlot(iz) DoubleSlot(vx) DoubleSlot(vy) DoubleSlot(vz)
+    DoubleSlot(fx) DoubleSlot(fy) DoubleSlot(fz) DoubleSlot(q)
+    DoubleSlot(mux) DoubleSlot(muy) DoubleSlot(muz) DoubleSlot(mu)
+  };
+  #undef IntSlot
+  #undef DoubleSlot
+  #undef PositionSlot
+  const size_t n_property_slots= sizeof(property_slots)/sizeof(property_slots[0]);
+
+  const PropertySlot* FindProperty(const std::string& name) {
+    for(size_t i= 0; i < n_property_slots; i++) {
+      if(name.compare(property_slots[i].name) == 0) {
+	return &property_slots[i];
+      }
+    }
+    return NULL;
+  }
+
+
+
+  bool LAMMPSReader::CompilePlan(const std::vector<std::string>& args, const std::vector<std::string>& avail_columns) {
+    //works out, once per frame, where each requested property comes from and goes to
+    plan.clear();
+    plan_columns= avail_columns.size();
+    for(std::vector<std::string>::const_iterator it= args.begin(); it < args.end(); it++) {
+      PlanEntry e;
+      if(!compileEntry(*it, avail_columns, e)) {
+	return false;
+      }
+      plan.push_back(e);
+    }
+    //the filters are compiled the same way, but don't have to be among the requested properties
+    filter_span= 0;
+    for(std::vector<Filter>::iterator it= filters.begin(); it < filters.end(); it++) {
+      if(!compileEntry(it->property, avail_columns, it->entry)) {
+	return false;
+      }
+      filter_span= std::max(filter_span, it->entry.column + 1);
+    }
+    return true;
+  }
+
+  bool LAMMPSReader::compileEntry(const std::string& name, const std::vector<std::string>& avail_columns, PlanEntry& e) {
+    e.column= std::find(avail_columns.begin(), avail_columns.end(), name) - avail_columns.begin();
+    if(e.column == avail_columns.size()) {
+      //one of the requested columns isn't in the file
+      std::cerr << "ERROR: '" << name << "' was requested from the dump file, but it doesn't appear to exist. The available data in this frame (tstep = " << last_tstep << ") are: ";
+      for(std::vector<std::string>::const_iterator jt= avail_columns.begin(); jt < avail_columns.end(); jt++) {
+	std::cerr << *jt << " ";
+      }
+      std::cerr << " (" << curfile << ")" << std::endl;
+      return false;
+    }
+    const PropertySlot *slot= FindProperty(name);
+    if(!slot) {
+      std::cerr << "ERROR: LAMMPSReader doesn't know what to do with the property '" << name << "'. This is a shortcoming in LAMMPSReader. (" << curfile << ")" << std::endl;
+      std::cerr << "Aside for the technically minded: To correct this error, add the property to AtomData, Frame and property_slots." << std::endl;
+      return false;
+    }
+    e.islot= slot->islot;
+    e.dslot= slot->dslot;
+    e.icol= slot->icol;
+    e.dcol= slot->dcol;
+    int dim= slot->dim;
+    bool scaled= slot->scaled;
+    //check the PBCs
+    //LAMMPS only updates them on reneighbouring steps
+    e.wrap_lo= wrap && dim >= 0 && boundaries[dim][0] == 'p';
+    e.wrap_hi= wrap && dim >= 0 && boundaries[dim][1] == 'p';
+    e.lo= scaled ? 0.0 : (dim >= 0 ? box_lo[dim] : 0.0);
+    e.hi= scaled ? 1.0 : (dim >= 0 ? box_hi[dim] : 0.0);
+    return true;
+  }
+
+  double LAMMPSReader::wrapValue(const PlanEntry& e, double v) {
+    if(e.wrap_lo && v < e.lo) {
+      v+= (e.hi - e.lo);
+    } else if(e.wrap_hi && v >= e.hi) {
+      v-= (e.hi - e.lo);
+    }
+    return v;
+  }
+
+  //both return false if one of the tokens isn't a number
+  bool LAMMPSReader::applyPlan(AtomData& ad, const std::vector<Token>& t) {
+    bool ok= true;
+    for(std::vector<PlanEntry>::const_iterator it= plan.begin(); it < plan.end(); it++) {
+      const Token& tok= t[it->column];
+      if(it->islot) {
+	ok&= ParseInt(tok.begin, tok.end, ad.*(it->islot));
+      } else {
+	ok&= ParseDouble(tok.begin, tok.end, ad.*(it->dslot));
+	ad.*(it->dslot)= wrapValue(*it, ad.*(it->dslot));
+      }
+    }
+    return ok;
+  }
+
+  bool LAMMPSReader::applyPlan(Frame& f, size_t row, const std::vector<Token>& t) {
+    bool ok= true;
+    for(std::vector<PlanEntry>::const_iterator it= plan.begin(); it < plan.end(); it++) {
+      const Token& tok= t[it->column];
+      if(it->icol) {
+	ok&= ParseInt(tok.begin, tok.end, (f.*(it->icol))[row]);
+      } else {
+	double& v= (f.*(it->dcol))[row];
+	ok&= ParseDouble(tok.begin, tok.end, v);
+	v= wrapValue(*it, v);
+      }
+    }
+    return ok;
+  }
+
+  int LAMMPSReader::filterAtom(const std::vector<Token>& t) const {
+    //returns 1 if the atom passes the filters, 0 if it doesn't, and -1 if one of its filtered values isn't a number
+    //only the filter columns are converted, so a rejected line costs very little
+    for(std::vector<Filter>::const_iterator it= filters.begin(); it < filters.end(); it++) {
+      const Token& tok= t[it->entry.column];
+      int i;
+      double v;
+      if(it->entry.dslot) {
+	if(!ParseDouble(tok.begin, tok.end, v)) {
+	  return -1;
+	}
+	v= wrapValue(it->entry, v);
+      } else {
+	if(!ParseInt(tok.begin, tok.end, i)) {
+	  return -1;
+	}
+	if(it->by_id) {
+	  if(!std::binary_search(filter_ids.begin(), filter_ids.end(), i)) {
+	    return 0;
+	  }
+	  continue;
+	}
+	v= i;
+      }
+      if(v < it->lo || v > it->hi) {
+	return 0;
+      }
+    }
+    return 1;
+  }
+
+  void LAMMPSReader::badNumber(const std::vector<Token>& t) const {
+    //reports the first of the wanted or filtered columns in t which isn't a number
+    for(size_t i= 0; i < plan.size() + filters.size(); i++) {
+      const PlanEntry& e= (i < plan.size()) ? plan[i] : filters[i - plan.size()].entry;
+      const Token& tok= t[e.column];
+      int iv;
+      double dv;
+      if(e.islot ? !ParseInt(tok.begin, tok.end, iv) : !ParseDouble(tok.begin, tok.end, dv)) {
+	std::cerr << "ERROR: The " << avail_columns[e.column] << " column of an atom in timestep " << last_tstep << " holds '" << std::string(tok.begin, tok.end)
+		  << "', which isn't " << (e.islot ? "an integer that fits in an int" : "a number") << ". (" << curfile << ")" << std::endl;
+	return;
+      }
+    }
+  }
+
+  size_t LAMMPSReader::selectAtoms(const char *buf, size_t fields_per_atom, size_t natoms,
+				   std::vector<unsigned char>& mask, std::vector<uint32_t>& sel) const {
+    //tests the natoms atoms of a binary block against the filters, a filter at a time,
+    //and lists the ones which pass in sel
+    size_t stride= fields_per_atom*sizeof(double);
+    mask.assign(natoms, 1);
+    for(std::vector<Filter>::const_iterator it= filters.begin(); it < filters.end(); it++) {
+      const char *src= buf + it->entry.column*sizeof(double);
+      if(it->by_id) {
+	for(size_t i= 0; i < natoms; i++) {
+	  double v;
+	  memcpy(&v, src + i*stride, sizeof(double));
+	  mask[i]&= std::binary_search(filter_ids.begin(), filter_ids.end(), static_cast<int>(v));
+	}
+	continue;
+      }
+      const PlanEntry& e= it->entry;
+      double len= e.hi - e.lo;
+      for(size_t i= 0; i < natoms; i++) {
+	double v;
+	memcpy(&v, src + i*stride, sizeof(double));
+	double up= (e.wrap_lo && v < e.lo) ? len : 0.0;
+	double down= (e.wrap_hi && v >= e.hi) ? len : 0.0;
+	v+= up - down;
+	mask[i]&= (v >= it->lo) & (v <= it->hi);
+      }
+    }
+    sel.resize(natoms);
+    size_t n= 0;
+    for(size_t i= 0; i < natoms; i++) {
+      sel[n]= i;
+      n+= mask[i];
+    }
+    return n;
+  }
+
+  void LAMMPSReader::PrepareFrame(Frame& f) {
+    //copies the header into f, and sizes its arrays for the properties in the plan
+    f.timestep= last_tstep;
+    f.n_atoms= n_atoms;
+    f.n_rows= -1;
+    memcpy(f.boundaries, boundaries, sizeof(boundaries));
+    for(int i= 0; i < 3; i++) {
+      f.box_lo[i]= box_lo[i];
+      f.box_hi[i]= box_hi[i];
+    }
+    sizeColumns(f, n_atoms);
+  }
+
+  void LAMMPSReader::sizeColumns(Frame& f, size_t n) const {
+    //the arrays in the plan get n rows, and the rest are emptied
+    for(size_t i= 0; i < n_property_slots; i++) {
+      const PropertySlot& slot= property_slots[i];
+      bool wanted= false;
+      for(std::vector<PlanEntry>::const_iterator it= plan.begin(); it < plan.end(); it++) {
+	wanted= wanted || (slot.icol ? it->icol == slot.icol : it->dcol == slot.dcol);
+      }
+      if(slot.icol) {
+	std::vector<int>& col= f.*slot.icol;
+	if(wanted) {
+	  col.resize(n);
+	} else if(!col.empty()) {
+	  std::vector<int>().swap(col);
+	}
+      } else {
+	std::vector<double>& col= f.*slot.dcol;
+	if(wanted) {
+	  col.resize(n);
+	} else if(!col.empty()) {
+	  std::vector<double>().swap(col);
+	}
+      }
+    }
+  }
+
+  bool LAMMPSReader::orderById(Frame& f) {
+    //moves every atom of f into row id-1, out of the id_rows which every frame so far has had,
+    //leaving the rows of atoms which aren't in this frame empty
+    size_t n= f.size();
+    if(f.id.size() != n) {
+      std::cerr << "ERROR: id_order is set, so 'id' must be one of the properties given to ReadFrame(). (" << curfile << ")" << std::endl;
+      return false;
+    }
+    int min_id= n ? f.id[0] : 1;
+    int max_id= n ? f.id[0] : 0;
+    for(size_t r= 0; r < n; r++) {
+      min_id= std::min(min_id, f.id[r]);
+      max_id= std::max(max_id, f.id[r]);
+    }
+    if(min_id < 1) {
+      std::cerr << "ERROR: Timestep " << f.timestep << " contains an atom with the id " << min_id << ", but ids must be positive to put the atoms in order of id. (" << curfile << ")" << std::endl;
+      return false;
+    }
+    //the first frame gives a row to every atom its header counts, even those filtered out
+    size_t header= std::max(n, static_cast<size_t>(n_atoms));
+    size_t rows= std::max(static_cast<size_t>(max_id), id_rows ? id_rows : header);
+    if(rows > id_rows) {
+      //the rows only grow while the ids are reasonably dense, so that a stray large id
+      //can't make every frame enormous
+      size_t most= 2*std::max(id_rows, header) + 1024;
+      if(rows > most) {
+	std::cerr << "ERROR: Timestep " << f.timestep << " contains an atom with id " << max_id << ", but id_order can only give the atoms of this trajectory up to " << most << " rows. (" << curfile << ")" << std::endl;
+	return false;
+      }
+      id_rows= rows;
+    }
+    //the ids go first, and an id which finds its row taken is a duplicate
+    order_ints.assign(id_rows, 0);
+    for(size_t r= 0; r < n; r++) {
+      int& row= order_ints[f.id[r] - 1];
+      if(row) {
+	std::cerr << "ERROR: Timestep " << f.timestep << " contains more than one atom with id " << f.id[r] << ", so its atoms can't be put in order of id. (" << curfile << ")" << std::endl;
+	return false;
+      }
+      row= f.id[r];
+    }
+    //the ids as they were read are kept in order_rows to place the other columns, each of which is
+    //scattered into a spare array, with the empty rows zeroed, which is then swapped in, so that
+    //the old array becomes the spare for the next column
+    f.id.swap(order_ints);
+    order_rows.swap(order_ints);
+    for(std::vector<PlanEntry>::const_iterator it= plan.begin(); it < plan.end(); it++) {
+      if(it->icol == &Frame::id) {
+	continue;
+      } else if(it->icol) {
+	std::vector<int>& col= f.*(it->icol);
+	order_ints.assign(id_rows, 0);
+	for(size_t r= 0; r < n; r++) {
+	  order_ints[order_rows[r] - 1]= col[r];
+	}
+	col.swap(order_ints);
+      } else {
+	std::vector<double>& col= f.*(it->dcol);
+	order_doubles.assign(id_rows, 0.0);
+	for(size_t r= 0; r < n; r++) {
+	  order_doubles[order_rows[r] - 1]= col[r];
+	}
+	col.swap(order_doubles);
+      }
+    }
+    f.n_rows= id_rows;
+    return true;
+  }
+
+  void LAMMPSReader::fitIdRows(Frame& f) {
+    //a frame ordered by another reader may have been given fewer rows than this one has
+    //handed out already, if the atoms with the largest ids weren't in the frames it read,
+    //so its columns are padded with empty rows; with more rows, it sets the rows from now on
+    if(f.n_rows < 0) {
+      return;
+    }
+    if(static_cast<size_t>(f.n_rows) >= id_rows) {
+      id_rows= f.n_rows;
+      return;
+    }
+    for(size_t i= 0; i < n_property_slots; i++) {
+      const PropertySlot& slot= property_slots[i];
+      if(slot.icol && !(f.*slot.icol).empty()) {
+	(f.*slot.icol).resize(id_rows, 0);
+      } else if(slot.dcol && !(f.*slot.dcol).empty()) {
+	(f.*slot.dcol).resize(id_rows, 0.0);
+      }
+    }
+    f.n_rows= id_rows;
+  }
+
+  bool LAMMPSReader::FinishFrame(Frame& f, size_t lines, size_t rows) {
+    //a frame is only complete if it held as many atoms as its header promised
+    //rows of them were kept by the filters, and the arrays are cut down to match
+    if(lines != f.size()) {
+      std::cerr << "ERROR: Timestep " << f.timestep << " contains " << lines << " atoms, but its header says there should be " << f.n_atoms << ". (" << curfile << ")" << std::endl;
+      return false;
+    }
+    if(rows < lines) {
+      for(std::vector<PlanEntry>::const_iterator it= plan.begin(); it < plan.end(); it++) {
+	if(it->icol) {
+	  (f.*(it->icol)).resize(rows);
+	} else {
+	  (f.*(it->dcol)).resize(rows);
+	}
+      }
+      f.n_atoms= rows;
+    }
+    return true;
+  }
 };
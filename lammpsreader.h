@@ -24,6 +24,7 @@
 #define LAMMPSREADER_H
 
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <string>
 #include <vector>
@@ -49,7 +50,114 @@ namespace LAMMPSReaderNS {
     double q;
   };
 
+  //the properties, named at compile time for ReadFrame<...>()
+  namespace Fields {
+    enum Field {id, type, mol, mass, x, y, z, xs, ys, zs, xu, yu, zu,
+    xsu, ysu, zsu, ix, iy, iz, vx, vy, vz, fx, fy, fz, q, mux, muy, muz, mu};
+  }
+  using Fields::Field;
+  //the name of a field, as it appears in the ITEM: ATOMS line
+  const char* FieldName(Field);
+
+  //FieldValue<Fields::x> holds a double named x, and so on for every field
+  template<Field F> struct FieldValue;
+  #define FieldSlot(T, tag) template<> struct FieldValue<Fields::tag> { T tag; T& value() { return tag; } };
+  FieldSlot(int, id) FieldSlot(int, type) FieldSlot(int, mol) FieldSlot(double, mass)
+  FieldSlot(double, x) FieldSlot(double, y) FieldSlot(double, z)
+  FieldSlot(double, xs) FieldSlot(double, ys) FieldSlot(double, zs)
+  FieldSlot(double, xu) FieldSlot(double, yu) FieldSlot(double, zu)
+  FieldSlot(double, xsu) FieldSlot(double, ysu) FieldSlot(double, zsu)
+  FieldSlot(int, ix) FieldSlot(int, iy) FieldSlot(int, iz)
+  FieldSlot(double, vx) FieldSlot(double, vy) FieldSlot(double, vz)
+  FieldSlot(double, fx) FieldSlot(double, fy) FieldSlot(double, fz)
+  FieldSlot(double, q) FieldSlot(double, mux) FieldSlot(double, muy) FieldSlot(double, muz)
+  FieldSlot(double, mu)
+  #undef FieldSlot
+
+  //an atom holding only the given fields, as members named after them,
+  //so Record<Fields::id, Fields::x> has just an int id and a double x
+  template<Field... F> struct Record : FieldValue<F>... {};
+
+  //one entry of the frame index: where a frame starts in the file and
+  //what its header says
+  struct FrameInfo {
+    int64_t offset;
+    int64_t timestep;
+    int64_t n_atoms;
+    char boundaries[3][2];
+    double box_lo[3];
+    double box_hi[3];
+  };
+
+  //a whole frame, stored as one array per property
+  //only the properties passed to ReadFrame() are filled in, the rest are left empty
+  //the arrays are reused from one frame to the next
+  struct Frame {
+    int64_t timestep;
+    int64_t n_atoms;
+    char boundaries[3][2];
+    double box_lo[3];
+    double box_hi[3];
+    std::vector<int> id;
+    std::vector<int> type;
+    std::vector<int> mol;
+    std::vector<double> mass;
+    std::vector<double> x, y, z;
+    std::vector<double> xs, ys, zs;
+    std::vector<double> xu, yu, zu;
+    std::vector<double> xsu, ysu, zsu;
+    std::vector<int> ix, iy, iz;
+    std::vector<double> vx, vy, vz;
+    std::vector<double> fx, fy, fz;
+    std::vector<double> mux, muy, muz;
+    std::vector<double> mu;
+    std::vector<double> q;
+
+    //with id_order, the number of rows, counting the empty ones; -1 when every row is an atom
+    int64_t n_rows;
+
+    Frame() : timestep(-1), n_atoms(0), n_rows(-1) {}
+    size_t size() const { return n_rows < 0 ? n_atoms : n_rows; }
+  };
+
+  //where a property lives in an AtomData and in a Frame, one of each pair being NULL
+  //dim is the dimension a position is wrapped in (-1 for everything else), and scaled
+  //says it's a fraction of the box
+  struct PropertySlot {
+    const char *name;
+    int AtomData::*islot;
+    double AtomData::*dslot;
+    std::vector<int> Frame::*icol;
+    std::vector<double> Frame::*dcol;
+    int dim;
+    bool scaled;
+  };
+  //every property the library knows, in the order of Fields::Field
+  extern const PropertySlot property_slots[];
+  extern const size_t n_property_slots;
+  //the slot for a property, by the name used in the ITEM: ATOMS line, or NULL if it's unknown
+  const PropertySlot* FindProperty(const std::string&);
+
+  //what a reader has done, and where its time went, collected when collect_stats is set
+  //the times are in nanoseconds, and everything adds up from open() until ResetStats()
+  struct ReaderStats {
+    int64_t bytes;
+    int64_t frames;
+    int64_t atoms;
+    int64_t io_ns;        //reading the file, or finding lines in a mapped file
+    int64_t tokenize_ns;  //splitting lines into tokens
+    int64_t convert_ns;   //converting numbers, and wrapping them into the box
+    int64_t callback_ns;  //in the Callback functions
+    int64_t total_ns;     //in ReadFrame() altogether
+
+    ReaderStats() { Reset(); }
+    void Reset();
+    std::string ToJSON() const;
+  };
+
   class LAMMPSReader;
+  class ReadAheadBuf;
+  class DecompressBuf;
 
   class Callback {
   public:
@@ -60,34 +168,225 @@ namespace LAMMPSReaderNS {
   };
   
   class LAMMPSReader {
+    //the parallel readers drive the scanning and seeking functions directly
+    friend class ParallelReader;
+    friend class TrajectorySet;
+    friend class SplitDumpReader;
   public:
     char boundaries[3][2];
 
     double box_lo[3];
     double box_hi[3];
     bool wrap;
+    //threads used to parse each frame read into a Frame, from a mapped text file or a binary file
+    int threads;
+    //ReadFrame() reads every stride-th frame, skipping the ones in between without parsing them
+    int stride;
+    //ReadFrame() hands the atoms over in order of id, so that the rows of one frame line up with the next
+    bool id_order;
+    //collect timings and counters in Stats(), at the cost of a few clock reads per atom
+    bool collect_stats;
+    //for a dump which is still being written: ReadFrame() waits until the next frame has been
+    //written in full, giving up if the file doesn't grow for follow_timeout seconds (0 waits for ever)
+    bool follow;
+    double follow_timeout;
 
-    int last_tstep;
+    int64_t last_tstep;
     int n_atoms;
     
     LAMMPSReader();
     ~LAMMPSReader();
 
-    bool open(const std::string&, bool bin= false);
+    bool open(const std::string&, bool bin= false, bool map= false);
     void close();
+    //read the file ahead of the parser on a background thread, in depth chunks of chunk bytes
+    bool EnablePrefetch(size_t depth= 2, size_t chunk= 4194304);
 
     bool ReadFrame(const std::string&, Callback *c);
+    bool ReadFrame(const std::string&, Frame&);
+    //gives every column of a binary file, in order, so that ReadFrame() need only name the ones it wants
+    void SetBinaryColumns(const std::string&);
+    //atoms failing a filter are dropped as they're read, before the rest of their data is converted
+    //a filter may use any property in the file, whether or not it is requested
+    void AddFilter(const std::string& property, double lo, double hi);
+    void FilterIds(const std::vector<int>&);
+    void FilterRegion(const double lo[3], const double hi[3]);
+    void ClearFilters();
+    //passes a frame to the callbacks, as though this reader had just read it
+    void ReplayFrame(const Frame&, Callback *c);
+
+    //random access to frames, via an index of frame offsets
+    bool BuildIndex(bool use_sidecar= true);
+    bool SeekFrame(size_t);
+    bool SeekTimestep(int64_t);
+    const std::vector<FrameInfo>& Index() const { return index; }
+    //the header of every frame, read without touching the atoms, using the index if it has been built
+    bool ScanHeaders(std::vector<FrameInfo>&, bool use_sidecar= true);
+    //moves past the next n frames without parsing their atoms
+    bool SkipFrames(size_t n);
+    //for splitting a file between nshards processes: gives the bytes [begin, end) holding shard's
+    //share of the frames, which together cover every frame once
+    //text files are split evenly by size, at the first frame starting after each split, so only
+    //a little of the file is read; binary and compressed files are split by frame, using the index
+    //the last shard of a compressed file has an end of -1, as its decompressed size isn't known
+    bool ShardRange(int nshards, int shard, int64_t& begin, int64_t& end);
+    //moves to begin, and makes ReadFrame() stop at the first frame starting at or after end,
+    //until the next SetRange() or open(); an end of -1 reads on to the end of the file
+    bool SetRange(int64_t begin, int64_t end);
+    const ReaderStats& Stats() const { return stats; }
+    void ResetStats() { stats.Reset(); }
+
+    //reads the next frame, calling visitor(record) for each atom, with a Record<F...>
+    //the loop is built for just those fields, so no other fields are converted or stored,
+    //and the visitor is called directly, so it can be inlined
+    //binary files need SetBinaryColumns(), and the atoms come in file order, so id_order can't be used
+    template<Field... F, class V> bool ReadFrame(V&& visitor);
   private:
     bool binary;
+    std::vector<std::string> binary_columns;
     std::ifstream file;
     std::string curfile;
-    bool updateAtomData(AtomData&, const std::string&, const std::string&);
-    bool ReadBinaryFrame(const std::vector<std::string>&, Callback*);
+    ReadAheadBuf *readahead;
+    //gzip and zstd files are decompressed as they're read
+    DecompressBuf *decompressor;
+    std::string pointsName() const;
+
+    //when a text file is memory mapped, it is parsed in place
+    bool mapped;
+    const char *map_begin;
+    size_t map_size;
+    size_t map_pos;
+    struct Token {
+      const char *begin;
+      const char *end;
+    };
+    std::vector<Token> tokens;
+    //lines read through the stream go into line_buf, and are tokenized in place, and the
+    //column names of the last ATOMS line are kept in avail_columns
+    //these are reused for every line and frame, so steady-state reading doesn't allocate
+    std::string line_buf;
+    std::vector<std::string> avail_columns;
+    void tokenizeLine(const std::string&);
+    void setColumns(std::vector<Token>::const_iterator, std::vector<Token>::const_iterator);
+    //the arguments to ReadFrame(), split up the last time they changed
+    std::string last_args;
+    std::vector<std::string> split_args;
+    const std::vector<std::string>& splitArgs(const std::string&);
+    bool ReadMappedFrame(const std::vector<std::string>&, Callback*, Frame*);
+    std::vector<FrameInfo> index;
+    bool seekTo(int64_t);
+    //frames still to be skipped before the next ReadFrame(), when stride > 1
+    size_t pending_skip;
+    //the end given to SetRange(), or -1
+    int64_t range_end;
+    bool pastRange();
+    bool shardBoundary(int, int, int64_t&);
+    bool skipLines(int64_t);
+    bool scanFrames(size_t);
+    std::string sidecarName() const;
+    bool LoadIndex();
+    bool SaveIndex();
+    int ScanTextFrame(FrameInfo&);
+    int scanTextHeader(FrameInfo&, bool);
+    int ScanBinaryFrame(FrameInfo&);
+    bool ReadBinaryHeader(FrameInfo&, int&, int&);
+    //follow mode: the inotify descriptor (-1 until needed), and where the frame being read ends
+    int follow_fd;
+    int64_t frame_end;
+    bool followFrame();
+    bool waitForFrame(int64_t&, int64_t&);
+    int frameComplete(int64_t, int64_t&);
+    bool waitForGrowth(int64_t);
+    int64_t fileSize() const;
+    bool remapFile(size_t);
+    ReaderStats stats;
+    //adds the time since t to phase, and moves t on to now, if stats are being collected
+    void lap(int64_t& phase, int64_t& t) const;
+    int64_t startLap() const;
+    bool ReadFrameInto(const std::vector<std::string>&, Callback*, Frame*);
+    bool ReadTextFrame(const std::vector<std::string>&, Callback*, Frame*);
+    bool ReadBinaryFrame(const std::vector<std::string>&, Callback*, Frame*);
     
-    enum property {ID, TYPE, MOL, MASS, X, Y, Z, XS, YS, ZS, XU, YU, ZU,
-    XSU, YSU, ZSU, IX, IY, IZ, VX, VY, VZ, FX, FY, FZ, Q, MUX, MUY, MUZ, 
-    MU, NULL_PROPERTY};
-    property string_to_property(const std::string& s);
+    //the ITEM: ATOMS header is compiled into a plan once per frame, so that the
+    //atom lines only have to follow it: for each requested property, the column
+    //it comes from, the AtomData field it goes to, and how it is wrapped
+    //when reading into a Frame, the array for each property is used instead
+    struct PlanEntry {
+      size_t column;
+      int AtomData::*islot;
+      double AtomData::*dslot;
+      std::vector<int> Frame::*icol;
+      std::vector<double> Frame::*dcol;
+      bool wrap_lo, wrap_hi;
+      double lo, hi;
+    };
+    std::vector<PlanEntry> plan;
+    size_t plan_columns;
+    bool CompilePlan(const std::vector<std::string>&, const std::vector<std::string>&);
+    bool compileEntry(const std::string&, const std::vector<std::string>&, PlanEntry&);
+
+    //a filter keeps atoms whose property lies in [lo, hi], or whose id is in filter_ids
+    //entry is where the property comes from, compiled along with the plan
+    struct Filter {
+      std::string property;
+      bool by_id;
+      double lo, hi;
+      PlanEntry entry;
+    };
+    std::vector<Filter> filters;
+    std::vector<int> filter_ids;
+    //the number of leading tokens needed to test every filter
+    size_t filter_span;
+    int filterAtom(const std::vector<Token>&) const;
+    void badNumber(const std::vector<Token>&) const;
+    size_t selectAtoms(const char*, size_t, size_t, std::vector<unsigned char>&, std::vector<uint32_t>&) const;
+    static double wrapValue(const PlanEntry&, double);
+    bool applyPlan(AtomData&, const std::vector<Token>&);
+    bool applyPlan(Frame&, size_t, const std::vector<Token>&);
+    bool ParseAtomsParallel(Frame&, size_t&, size_t&);
+
+    //for id_order, the atom with id i goes in row i-1 of id_rows, which is kept from frame
+    //to frame and only grows when a larger id turns up, so that every frame has the same rows
+    size_t id_rows;
+    std::vector<int> order_rows;
+    std::vector<int> order_ints;
+    std::vector<double> order_doubles;
+    Frame ordered;
+    bool orderById(Frame&);
+    void fitIdRows(Frame&);
+    void PrepareFrame(Frame&);
+    void sizeColumns(Frame&, size_t) const;
+    //the properties ReplayFrame() copies, kept so that replaying allocates nothing
+    std::vector<const PropertySlot*> replay_slots;
+    bool FinishFrame(Frame&, size_t, size_t);
+
+    //binary processor blocks are read whole into block_buf, then decoded a column at a time
+    std::vector<char> block_buf;
+    std::vector<AtomData> block_atoms;
+    //with filters, only the atoms listed in sel are decoded
+    std::vector<unsigned char> block_mask;
+    std::vector<uint32_t> block_sel;
+    void decodeBlock(const char*, size_t, size_t, AtomData*, const uint32_t *sel= NULL);
+    void decodeBlock(const char*, size_t, size_t, Frame&, size_t, const uint32_t *sel= NULL);
+
+    //the parts of ReadFrame<...>() which don't depend on the fields
+    //beginFrame() reads the header and compiles the plan, then each atom line, or processor
+    //block, is fetched in turn, and endFrame() checks that the frame was whole
+    std::vector<std::string> field_args;
+    int blocks_left;
+    int64_t frame_atoms;
+    int64_t frame_start_ns;
+    bool beginFrame(const Field*, size_t);
+    int nextAtomLine();
+    bool nextBlock(size_t&, const uint32_t*&);
+    bool endFrame();
+    //the text conversions return false if the token isn't a number
+    static bool tokenInt(const Token&, int&);
+    static bool tokenDouble(const Token&, double&);
+    bool convert(int& v, const Token& t, const PlanEntry&) const { return tokenInt(t, v); }
+    bool convert(double& v, const Token& t, const PlanEntry& e) const { bool ok= tokenDouble(t, v); v= wrapValue(e, v); return ok; }
+    void convert(int& v, double d, const PlanEntry&) const { v= static_cast<int>(d); }
+    void convert(double& v, double d, const PlanEntry& e) const { v= wrapValue(e, d); }
     
     //the following unions are used for reading binary files
     
@@ -106,6 +405,56 @@ namespace LAMMPSReaderNS {
       double d;
     } ud;
   };
+
+  template<Field... F, class V>
+  bool LAMMPSReader::ReadFrame(V&& visitor) {
+    static const Field fields[]= {F...};
+    if(!beginFrame(fields, sizeof...(F))) {
+      return false;
+    }
+    Record<F...> r;
+    if(binary) {
+      const size_t stride= plan_columns*sizeof(double);
+      size_t natoms;
+      const uint32_t *sel;
+      while(blocks_left > 0) {
+	if(!nextBlock(natoms, sel)) {
+	  return false;
+	}
+	for(size_t j= 0; j < natoms; j++) {
+	  const char *atom= block_buf.data() + (sel ? sel[j] : j)*stride;
+	  const PlanEntry *e= plan.data();
+	  double d;
+	  //each field is decoded in turn, with the types and members known at compile time
+	  int expand[]= {0, (memcpy(&d, atom + e->column*sizeof(double), sizeof(double)),
+			     convert(static_cast<FieldValue<F>&>(r).value(), d, *e++), 0)...};
+	  (void)expand;
+	  visitor(static_cast<const Record<F...>&>(r));
+	}
+      }
+      return endFrame();
+    }
+    for(int64_t i= 0; i < n_atoms; i++) {
+      int status= nextAtomLine();
+      if(status < 0) {
+	return false;
+      }
+      if(status == 0) {
+	//filtered out
+	continue;
+      }
+      const PlanEntry *e= plan.data();
+      bool ok= true;
+      int expand[]= {0, (ok&= convert(static_cast<FieldValue<F>&>(r).value(), tokens[e->column], *e), e++, 0)...};
+      (void)expand;
+      if(!ok) {
+	badNumber(tokens);
+	return false;
+      }
+      visitor(static_cast<const Record<F...>&>(r));
+    }
+    return endFrame();
+  }
 }
 
 #endif
@@ -0,0 +1,475 @@
+/*
+    lammpswriter.cpp
+    LAMMPSWriter writes text and binary dump files, for trimming trajectories down
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <algorithm>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "lammpswriter.h"
+
+namespace LAMMPSReaderNS {
+
+  //output is written in pieces of about this many bytes
+  static const size_t buffer_size= 1 << 20;
+  //the most characters a number takes, with the space after it
+  static const size_t max_field= 32;
+
+  //integers are written by hand, which is much quicker than printf
+  static char* put_int(char *p, int64_t v) {
+    uint64_t u= v;
+    if(v < 0) {
+      *p++= '-';
+      u= 0 - u;
+    }
+    char digits[20];
+    int n= 0;
+    do {
+      digits[n++]= '0' + u % 10;
+      u/= 10;
+    } while(u);
+    while(n) {
+      *p++= digits[--n];
+    }
+    return p;
+  }
+
+  static const double exact_powers[]= {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+				       1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  static const int max_exact_power= 22;
+  static const uint64_t int_powers[]= {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+				       100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+				       10000000000000ULL, 100000000000000ULL, 1000000000000000ULL};
+  //above this many digits, the scaled value isn't held exactly enough to round it here
+  static const int max_fast_precision= 15;
+
+  //writes v as printf's %.<precision>g would, or returns NULL if it can't be sure of
+  //getting the same digits, leaving it to printf
+  //v is scaled by a power of ten to a precision digit integer, which is exact apart from the one
+  //rounding of the multiply or divide, so only a value within that rounding of a tie is unsure
+  static char* put_general(char *p, double v, int precision) {
+    if(precision > max_fast_precision || std::isnan(v) || std::isinf(v)) {
+      return NULL;
+    }
+    if(v == 0.0) {
+      if(std::signbit(v)) {
+	*p++= '-';
+      }
+      *p++= '0';
+      return p;
+    }
+    double a= std::fabs(v);
+    int e= static_cast<int>(std::floor(std::log10(a)));
+    int k= precision - 1 - e;
+    if(k > max_exact_power || k < -max_exact_power) {
+      return NULL;
+    }
+    double s= (k >= 0) ? a*exact_powers[k] : a/exact_powers[-k];
+    double whole= std::floor(s);
+    double frac= s - whole;
+    if(std::fabs(frac - 0.5) <= s*4e-16) {
+      return NULL;
+    }
+    uint64_t d= static_cast<uint64_t>(whole) + (frac > 0.5 ? 1 : 0);
+    if(d == int_powers[precision]) {
+      //rounded up to the next power of ten
+      d= int_powers[precision - 1];
+      e++;
+    } else if(d > int_powers[precision] || d < int_powers[precision - 1]) {
+      //log10 was out by one
+      return NULL;
+    }
+    char digits[max_fast_precision];
+    for(int i= precision - 1; i >= 0; i--) {
+      digits[i]= '0' + d % 10;
+      d/= 10;
+    }
+    //%g drops trailing zeros, and the point if nothing follows it
+    int n= precision;
+    while(n > 1 && digits[n - 1] == '0') {
+      n--;
+    }
+    if(v < 0) {
+      *p++= '-';
+    }
+    if(e < -4 || e >= precision) {
+      *p++= digits[0];
+      if(n > 1) {
+	*p++= '.';
+	memcpy(p, digits + 1, n - 1);
+	p+= n - 1;
+      }
+      *p++= 'e';
+      *p++= (e < 0) ? '-' : '+';
+      int ae= (e < 0) ? -e : e;
+      if(ae >= 100) {
+	*p++= '0' + ae/100;
+      }
+      *p++= '0' + (ae/10) % 10;
+      *p++= '0' + ae % 10;
+    } else if(e >= 0) {
+      memcpy(p, digits, e + 1);
+      p+= e + 1;
+      if(n > e + 1) {
+	*p++= '.';
+	memcpy(p, digits + e + 1, n - e - 1);
+	p+= n - e - 1;
+      }
+    } else {
+      *p++= '0';
+      *p++= '.';
+      for(int i= -1; i > e; i--) {
+	*p++= '0';
+      }
+      memcpy(p, digits, n);
+      p+= n;
+    }
+    return p;
+  }
+
+  static char* put_text(char *p, const char *s) {
+    size_t len= strlen(s);
+    memcpy(p, s, len);
+    return p + len;
+  }
+
+  template<class T> static char* put_binary(char *p, T v) {
+    memcpy(p, &v, sizeof(T));
+    return p + sizeof(T);
+  }
+
+  //the boundary codes of the binary format
+  static int boundary_code(char c) {
+    switch(c) {
+    case 'p': return 0;
+    case 'f': return 1;
+    case 's': return 2;
+    case 'm': return 3;
+    }
+    //unknown, which LAMMPSReader reads back as 'u'
+    return -1;
+  }
+
+  LAMMPSWriter::LAMMPSWriter() {
+    precision= 6;
+    binary= false;
+    ok= true;
+    used= 0;
+    point= '.';
+    cb_atoms= 0;
+    cb_used= 0;
+    block_atoms= 1;
+    for(int i= 0; i < 3; i++) {
+      cb_boundaries[i][0]= 'p';
+      cb_boundaries[i][1]= 'p';
+      cb_lo[i]= 0.0;
+      cb_hi[i]= 0.0;
+    }
+  }
+
+  LAMMPSWriter::~LAMMPSWriter() {
+    close();
+  }
+
+  bool LAMMPSWriter::open(const std::string& filename, const std::string& columns, bool bin) {
+    close();
+    names= explode(columns);
+    slots.clear();
+    if(names.empty()) {
+      std::cerr << "ERROR: LAMMPSWriter::open() needs at least one column. (" << filename << ")" << std::endl;
+      return false;
+    }
+    for(std::vector<std::string>::const_iterator it= names.begin(); it < names.end(); it++) {
+      const PropertySlot *slot= FindProperty(*it);
+      if(!slot) {
+	std::cerr << "ERROR: LAMMPSWriter doesn't know the property '" << *it << "'. (" << filename << ")" << std::endl;
+	return false;
+      }
+      slots.push_back(slot);
+    }
+    out.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if(!out.is_open()) {
+      std::cerr << "Error! Failed to open file " << filename << " for writing." << std::endl;
+      return false;
+    }
+    curfile= filename;
+    binary= bin;
+    ok= true;
+    //localeconv() isn't thread safe, so the locale's decimal point, which snprintf() writes and
+    //a dump can't have, is looked up here, on the thread which opens the file, and not per frame
+    point= *localeconv()->decimal_point;
+    buf.resize(buffer_size);
+    used= 0;
+    //a binary block fits in the buffer, along with its size
+    block_atoms= std::max<size_t>(1, (buffer_size - sizeof(int))/(slots.size()*sizeof(double)));
+    return true;
+  }
+
+  char* LAMMPSWriter::space(size_t n) {
+    //makes room for n more bytes in buf, writing out what's there if need be
+    if(used + n > buf.size()) {
+      flush();
+      if(n > buf.size()) {
+	buf.resize(n);
+      }
+    }
+    return buf.data() + used;
+  }
+
+  void LAMMPSWriter::flush() {
+    out.write(buf.data(), used);
+    used= 0;
+    if(out.fail()) {
+      ok= false;
+    }
+  }
+
+  char* LAMMPSWriter::putDouble(char *p, double v) const {
+    int prec= std::min(std::max(precision, 1), 17);
+    char *q= put_general(p, v, prec);
+    if(q) {
+      return q;
+    }
+    //printf rounds correctly, but is slow, and uses the locale's decimal point, which a dump can't have
+    int n= snprintf(p, max_field, "%.*g", prec, v);
+    if(point != '.') {
+      std::replace(p, p + n, point, '.');
+    }
+    return p + n;
+  }
+
+  void LAMMPSWriter::writeHeader(int64_t timestep, int64_t natoms, const char boundaries[3][2], const double *lo, const double *hi) {
+    char *p= space(512);
+    if(binary) {
+      p= put_binary<int64_t>(p, timestep);
+      p= put_binary<int64_t>(p, natoms);
+      //not triclinic
+      p= put_binary<int>(p, 0);
+      for(int i= 0; i < 3; i++) {
+	for(int j= 0; j < 2; j++) {
+	  p= put_binary<int>(p, boundary_code(boundaries[i][j]));
+	}
+      }
+      for(int i= 0; i < 3; i++) {
+	p= put_binary<double>(p, lo[i]);
+	p= put_binary<double>(p, hi[i]);
+      }
+      p= put_binary<int>(p, slots.size());
+      //even an empty frame has one block
+      p= put_binary<int>(p, std::max<int64_t>(1, (natoms + block_atoms - 1)/block_atoms));
+    } else {
+      p= put_text(p, "ITEM: TIMESTEP\n");
+      p= put_int(p, timestep);
+      p= put_text(p, "\nITEM: NUMBER OF ATOMS\n");
+      p= put_int(p, natoms);
+      p= put_text(p, "\nITEM: BOX BOUNDS");
+      for(int i= 0; i < 3; i++) {
+	*p++= ' ';
+	for(int j= 0; j < 2; j++) {
+	  if(boundaries[i][j]) {
+	    *p++= boundaries[i][j];
+	  }
+	}
+      }
+      *p++= '\n';
+      for(int i= 0; i < 3; i++) {
+	//the box is written with every digit, as LAMMPS does
+	int n= snprintf(p, 2*max_field, "%.16e %.16e\n", lo[i], hi[i]);
+	if(point != '.') {
+	  std::replace(p, p + n, point, '.');
+	}
+	p+= n;
+      }
+      used= p - buf.data();
+      p= space(16 + names.size()*max_field);
+      p= put_text(p, "ITEM: ATOMS");
+      for(std::vector<std::string>::const_iterator it= names.begin(); it < names.end(); it++) {
+	*p++= ' ';
+	p= put_text(p, it->c_str());
+      }
+      *p++= '\n';
+    }
+    used= p - buf.data();
+  }
+
+  bool LAMMPSWriter::WriteFrame(const Frame& f) {
+    if(!out.is_open()) {
+      std::cerr << "LAMMPSWriter::WriteFrame() called while no file is open." << std::endl;
+      return false;
+    }
+    size_t n= f.size();
+    for(size_t c= 0; c < slots.size(); c++) {
+      size_t have= slots[c]->icol ? (f.*(slots[c]->icol)).size() : (f.*(slots[c]->dcol)).size();
+      if(have != n) {
+	std::cerr << "ERROR: Timestep " << f.timestep << " was written without its '" << names[c] << "' column. (" << curfile << ")" << std::endl;
+	return false;
+      }
+    }
+    //a frame put in order of id has empty rows, with an id of 0, for the atoms it doesn't hold
+    bool holes= f.n_rows >= 0;
+    if(holes && f.id.size() != n) {
+      std::cerr << "ERROR: Timestep " << f.timestep << " was put in order of id, but has no 'id' column to tell its empty rows from its atoms. (" << curfile << ")" << std::endl;
+      return false;
+    }
+    size_t natoms= holes ? n - std::count(f.id.begin(), f.id.end(), 0) : n;
+    writeHeader(f.timestep, natoms, f.boundaries, f.box_lo, f.box_hi);
+    if(binary) {
+      //the atoms are written a row at a time, in blocks
+      size_t i= 0;
+      size_t left= natoms;
+      do {
+	size_t k= std::min(block_atoms, left);
+	char *p= space(sizeof(int) + k*slots.size()*sizeof(double));
+	p= put_binary<int>(p, k*slots.size());
+	for(size_t w= 0; w < k; i++) {
+	  if(holes && f.id[i] == 0) {
+	    continue;
+	  }
+	  for(size_t c= 0; c < slots.size(); c++) {
+	    p= put_binary<double>(p, slots[c]->icol ? (f.*(slots[c]->icol))[i] : (f.*(slots[c]->dcol))[i]);
+	  }
+	  w++;
+	}
+	left-= k;
+	used= p - buf.data();
+      } while(left > 0);
+    } else {
+      size_t line= slots.size()*max_field + 1;
+      for(size_t i= 0; i < n; i++) {
+	if(holes && f.id[i] == 0) {
+	  continue;
+	}
+	char *p= space(line);
+	for(size_t c= 0; c < slots.size(); c++) {
+	  if(c) {
+	    *p++= ' ';
+	  }
+	  p= slots[c]->icol ? put_int(p, (f.*(slots[c]->icol))[i]) : putDouble(p, (f.*(slots[c]->dcol))[i]);
+	}
+	*p++= '\n';
+	used= p - buf.data();
+      }
+    }
+    if(out.fail()) {
+      ok= false;
+    }
+    if(!ok) {
+      std::cerr << "ERROR: Failed to write timestep " << f.timestep << " to " << curfile << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  void LAMMPSWriter::StartOfTimestep(LAMMPSReader*) {
+    cb_atoms= 0;
+    cb_used= 0;
+    cb_values.clear();
+  }
+
+  void LAMMPSWriter::BoxBounds(char boundaries[3][2], double lo[3], double hi[3]) {
+    memcpy(cb_boundaries, boundaries, sizeof(cb_boundaries));
+    for(int i= 0; i < 3; i++) {
+      cb_lo[i]= lo[i];
+      cb_hi[i]= hi[i];
+    }
+  }
+
+  void LAMMPSWriter::AtomLine(const AtomData& ad, LAMMPSReader*) {
+    cb_atoms++;
+    if(binary) {
+      for(size_t c= 0; c < slots.size(); c++) {
+	cb_values.push_back(slots[c]->islot ? ad.*(slots[c]->islot) : ad.*(slots[c]->dslot));
+      }
+      return;
+    }
+    //the lines are kept in cb_text, which only grows, so that it's reused from frame to frame
+    size_t line= slots.size()*max_field + 1;
+    if(cb_used + line > cb_text.size()) {
+      cb_text.resize(std::max(2*cb_text.size(), cb_used + line));
+    }
+    char *p= cb_text.data() + cb_used;
+    for(size_t c= 0; c < slots.size(); c++) {
+      if(c) {
+	*p++= ' ';
+      }
+      p= slots[c]->islot ? put_int(p, ad.*(slots[c]->islot)) : putDouble(p, ad.*(slots[c]->dslot));
+    }
+    *p++= '\n';
+    cb_used= p - cb_text.data();
+  }
+
+  void LAMMPSWriter::EndOfTimestep(LAMMPSReader *lr) {
+    finishFrame(lr->last_tstep);
+  }
+
+  bool LAMMPSWriter::finishFrame(int64_t timestep) {
+    //writes the frame the callbacks collected
+    if(!out.is_open()) {
+      std::cerr << "LAMMPSWriter was given a frame while no file is open." << std::endl;
+      ok= false;
+      return false;
+    }
+    writeHeader(timestep, cb_atoms, cb_boundaries, cb_lo, cb_hi);
+    if(binary) {
+      const double *rows= cb_values.data();
+      int64_t i= 0;
+      do {
+	size_t k= std::min<int64_t>(block_atoms, cb_atoms - i);
+	char *p= space(sizeof(int));
+	p= put_binary<int>(p, k*slots.size());
+	used= p - buf.data();
+	flush();
+	out.write(reinterpret_cast<const char*>(rows + i*slots.size()), k*slots.size()*sizeof(double));
+	i+= k;
+      } while(i < cb_atoms);
+    } else {
+      flush();
+      out.write(cb_text.data(), cb_used);
+    }
+    if(out.fail()) {
+      ok= false;
+    }
+    if(!ok) {
+      std::cerr << "ERROR: Failed to write timestep " << timestep << " to " << curfile << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool LAMMPSWriter::close() {
+    if(!out.is_open()) {
+      return true;
+    }
+    flush();
+    bool good= ok && !out.fail();
+    out.close();
+    if(!good) {
+      std::cerr << "ERROR: Failed to finish writing " << curfile << std::endl;
+    }
+    curfile= "";
+    return good;
+  }
+}
@@ -0,0 +1,93 @@
+/*
+    lammpswriter.h
+    LAMMPSWriter writes text and binary dump files, for trimming trajectories down
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef LAMMPSWRITER_H
+#define LAMMPSWRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "lammpsreader.h"
+
+namespace LAMMPSReaderNS {
+
+  //writes dumps LAMMPSReader (and LAMMPS's own tools) can read, in text or in the binary format
+  //described in the README, with just the given columns
+  //frames can be written from a Frame, or the writer can be passed to ReadFrame() as the
+  //callback, so that the reader's filters, stride and choice of properties decide what is written
+  class LAMMPSWriter : public Callback {
+  public:
+    //significant digits of the doubles in a text dump: LAMMPS writes 6, and 17 keeps every bit
+    int precision;
+
+    LAMMPSWriter();
+    ~LAMMPSWriter();
+
+    //columns are property names, as for ReadFrame(), e.g. "id type x y z", in the order they're written
+    bool open(const std::string& filename, const std::string& columns, bool bin= false);
+    //every frame written must have all of the columns filled in
+    bool WriteFrame(const Frame&);
+    bool close();
+
+    //the callbacks keep the atoms of a frame, and write it when it ends, as the number of
+    //atoms comes first; the columns must all be among the properties the reader was asked for
+    void StartOfTimestep(LAMMPSReader*);
+    void BoxBounds(char[3][2], double[3], double[3]);
+    void AtomLine(const AtomData&, LAMMPSReader*);
+    void EndOfTimestep(LAMMPSReader*);
+    //false once a frame has failed to be written, as the callbacks can't say so
+    bool good() const { return ok; }
+  private:
+    std::ofstream out;
+    std::string curfile;
+    bool binary;
+    bool ok;
+    std::vector<std::string> names;
+    std::vector<const PropertySlot*> slots;
+
+    //everything is formatted into buf, which is written out as it fills, and reused
+    std::vector<char> buf;
+    size_t used;
+    char* space(size_t);
+    void flush();
+    char point;
+    char* putDouble(char*, double) const;
+
+    //the frame being collected by the callbacks: its atoms as text lines, or as rows of doubles
+    int64_t cb_atoms;
+    std::vector<char> cb_text;
+    size_t cb_used;
+    std::vector<double> cb_values;
+    char cb_boundaries[3][2];
+    double cb_lo[3];
+    double cb_hi[3];
+
+    //binary frames are split into blocks of at most this many atoms
+    size_t block_atoms;
+    void writeHeader(int64_t timestep, int64_t natoms, const char boundaries[3][2], const double *lo, const double *hi);
+    bool finishFrame(int64_t timestep);
+  };
+}
+
+#endif
@@ -0,0 +1,279 @@
+/*
+    numparse.cpp
+    Locale independent conversion of the numbers in dump file columns
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include <locale.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+#include "numparse.h"
+
+namespace LAMMPSReaderNS {
+
+  static bool is_space(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+  }
+
+  static bool is_digit(char ch) {
+    return static_cast<unsigned char>(ch - '0') < 10;
+  }
+
+  //drops the spaces from both ends of [b, e)
+  static void trim(const char *&b, const char *&e) {
+    while(b < e && is_space(*b)) {
+      b++;
+    }
+    while(e > b && is_space(e[-1])) {
+      e--;
+    }
+  }
+
+  bool ParseInt(const char *b, const char *e, int64_t& v) {
+    trim(b, e);
+    bool neg= false;
+    if(b < e && (*b == '-' || *b == '+')) {
+      neg= (*b == '-');
+      b++;
+    }
+    if(b == e) {
+      return false;
+    }
+    //the magnitude is built up unsigned, so that the most negative value fits
+    const uint64_t limit= static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + (neg ? 1 : 0);
+    uint64_t u= 0;
+    for(; b < e; b++) {
+      if(!is_digit(*b)) {
+	return false;
+      }
+      unsigned d= *b - '0';
+      if(u > (limit - d)/10) {
+	return false;
+      }
+      u= 10*u + d;
+    }
+    v= neg ? static_cast<int64_t>(0 - u) : static_cast<int64_t>(u);
+    return true;
+  }
+
+  bool ParseInt(const char *b, const char *e, int& v) {
+    int64_t w;
+    if(!ParseInt(b, e, w) || w < std::numeric_limits<int>::min() || w > std::numeric_limits<int>::max()) {
+      return false;
+    }
+    v= static_cast<int>(w);
+    return true;
+  }
+
+  //LAMMPS writes its columns with a fixed number of digits, so the digits are
+  //taken 8 at a time where they can be, in an ordinary 64 bit integer
+  //this relies on the bytes being little endian, so other machines take them one at a time
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  static bool eight_digits(const char *p, uint64_t& v) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    //every byte is between '0' and '9' if adding 6 to it leaves its high nibble 3, as it was
+    if((((w & 0xF0F0F0F0F0F0F0F0ULL) | (((w + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))) != 0x3333333333333333ULL) {
+      return false;
+    }
+    //pairs of digits, then fours, then all eight, are combined with a multiply each
+    w-= 0x3030303030303030ULL;
+    w= (w*10) + (w >> 8);
+    v= (((w & 0x000000FF000000FFULL)*(100 + (1000000ULL << 32))) + (((w >> 16) & 0x000000FF000000FFULL)*(1 + (10000ULL << 32)))) >> 32;
+    return true;
+  }
+#else
+  static bool eight_digits(const char*, uint64_t&) {
+    return false;
+  }
+#endif
+
+  //the powers of ten which are exactly doubles
+  static const double exact_powers[]= {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+				       1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  static const int max_exact_power= 22;
+  //and the largest integer below which every integer is
+  static const uint64_t max_exact_int= 1ULL << 53;
+  //the most digits which always fit in a uint64_t
+  static const int max_digits= 19;
+
+  static bool matches(const char *b, const char *e, const char *word) {
+    //case insensitive
+    size_t len= strlen(word);
+    if(static_cast<size_t>(e - b) != len) {
+      return false;
+    }
+    for(size_t i= 0; i < len; i++) {
+      if((b[i] | 0x20) != word[i]) {
+	return false;
+      }
+    }
+    return true;
+  }
+
+  static locale_t c_locale() {
+    //made once, and thread safe from then on, unlike localeconv() and setlocale()
+    static locale_t loc= newlocale(LC_ALL_MASK, "C", static_cast<locale_t>(0));
+    return loc;
+  }
+
+  static double slow_double(const char *b, const char *e) {
+    //strtod() is correctly rounded, but needs a terminated string, so the number is copied;
+    //strtod_l() in the "C" locale always takes '.' as the decimal point
+    char buf[128];
+    std::string big;
+    char *s= buf;
+    size_t len= e - b;
+    if(len >= sizeof(buf)) {
+      big.resize(len + 1);
+      s= &big[0];
+    }
+    memcpy(s, b, len);
+    s[len]= '\0';
+    return strtod_l(s, NULL, c_locale());
+  }
+
+  bool ParseDouble(const char *b, const char *e, double& v) {
+    trim(b, e);
+    const char *start= b;
+    bool neg= false;
+    if(b < e && (*b == '-' || *b == '+')) {
+      neg= (*b == '-');
+      b++;
+    }
+    if(b < e && !is_digit(*b) && *b != '.') {
+      //LAMMPS writes infinities and nans the way printf does
+      if(matches(b, e, "inf") || matches(b, e, "infinity")) {
+	v= neg ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+	return true;
+      }
+      if(matches(b, e, "nan")) {
+	v= neg ? -std::numeric_limits<double>::quiet_NaN() : std::numeric_limits<double>::quiet_NaN();
+	return true;
+      }
+      return false;
+    }
+    //the significant digits go into m, up to max_digits of them, and the number is m*10^exp10
+    //if any non-zero digits didn't fit, truncated is set
+    uint64_t m= 0;
+    int nd= 0;
+    int64_t exp10= 0;
+    bool truncated= false;
+    bool any= false;
+    //leading zeros aren't significant
+    for(; b < e && *b == '0'; b++) {
+      any= true;
+    }
+    for(; b < e && is_digit(*b); b++) {
+      any= true;
+      if(nd < max_digits) {
+	m= 10*m + (*b - '0');
+	nd++;
+      } else {
+	exp10++;
+	truncated|= (*b != '0');
+      }
+    }
+    if(b < e && *b == '.') {
+      b++;
+      if(nd == 0) {
+	for(; b < e && *b == '0'; b++) {
+	  any= true;
+	  exp10--;
+	}
+      }
+      uint64_t eight;
+      while(nd + 8 <= max_digits && e - b >= 8 && eight_digits(b, eight)) {
+	m= 100000000*m + eight;
+	nd+= 8;
+	exp10-= 8;
+	b+= 8;
+	any= true;
+      }
+      for(; b < e && is_digit(*b); b++) {
+	any= true;
+	if(nd < max_digits) {
+	  m= 10*m + (*b - '0');
+	  nd++;
+	  exp10--;
+	} else {
+	  truncated|= (*b != '0');
+	}
+      }
+    }
+    if(!any) {
+      return false;
+    }
+    if(b < e && (*b == 'e' || *b == 'E')) {
+      b++;
+      bool eneg= false;
+      if(b < e && (*b == '-' || *b == '+')) {
+	eneg= (*b == '-');
+	b++;
+      }
+      if(b == e) {
+	return false;
+      }
+      int64_t x= 0;
+      for(; b < e && is_digit(*b); b++) {
+	//anything this big is an overflow or underflow anyway
+	if(x < 100000) {
+	  x= 10*x + (*b - '0');
+	}
+      }
+      exp10+= eneg ? -x : x;
+    }
+    if(b != e) {
+      return false;
+    }
+    if(m == 0) {
+      v= neg ? -0.0 : 0.0;
+      return true;
+    }
+    //when m and 10^exp10 are both exact doubles, one multiply or divide rounds correctly
+    //this needs doubles to be evaluated as doubles, and not in wider registers
+#if defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD == 0)
+    if(!truncated && m <= max_exact_int) {
+      double d= static_cast<double>(m);
+      if(exp10 >= 0 && exp10 <= max_exact_power) {
+	d*= exact_powers[exp10];
+	v= neg ? -d : d;
+	return true;
+      }
+      if(exp10 < 0 && exp10 >= -max_exact_power) {
+	d/= exact_powers[-exp10];
+	v= neg ? -d : d;
+	return true;
+      }
+    }
+#endif
+    //otherwise, rounding it correctly is left to strtod()
+    v= slow_double(start, e);
+    return true;
+  }
+}
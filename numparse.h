@@ -0,0 +1,39 @@
+/*
+    numparse.h
+    Locale independent conversion of the numbers in dump file columns
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef NUMPARSE_H
+#define NUMPARSE_H
+
+#include <cstdint>
+
+namespace LAMMPSReaderNS {
+
+  //these convert the number in [b, e), which needn't be terminated, and may have spaces
+  //around it, and return false if it isn't a number, or doesn't fit, leaving v alone
+  //a '.' is always the decimal point, whatever the locale
+  bool ParseInt(const char *b, const char *e, int64_t& v);
+  bool ParseInt(const char *b, const char *e, int& v);
+  //correctly rounded, as strtod() is, and also accepts inf, infinity and nan
+  bool ParseDouble(const char *b, const char *e, double& v);
+}
+
+#endif
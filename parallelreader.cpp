@@ -0,0 +1,235 @@
+/*
+    parallelreader.cpp
+    ParallelReader reads the frames of a LAMMPS dump file on several threads
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "parallelreader.h"
+
+namespace LAMMPSReaderNS {
+
+  ParallelReader::ParallelReader(int threads, size_t d) {
+    wrap= true;
+    id_order= false;
+    nthreads= threads;
+    if(nthreads <= 0) {
+      nthreads= std::thread::hardware_concurrency();
+    }
+    if(nthreads <= 0) {
+      nthreads= 1;
+    }
+    depth= (d > 0) ? d : 2*nthreads;
+    binary= false;
+    mapped= false;
+    next_seq= 0;
+    total= 0;
+    scan_done= false;
+    scan_failed= false;
+    failed= false;
+    stopping= false;
+  }
+
+  ParallelReader::~ParallelReader() {
+    close();
+  }
+
+  bool ParallelReader::open(const std::string& filename, bool bin, bool map) {
+    close();
+    //the scanner only reads headers, so it doesn't need the file mapping
+    if(!scanner.open(filename, bin)) {
+      return false;
+    }
+    for(int i= 0; i < nthreads; i++) {
+      LAMMPSReader *r= new LAMMPSReader();
+      workers.push_back(r);
+      if(!r->open(filename, bin, map)) {
+	close();
+	return false;
+      }
+    }
+    curfile= filename;
+    binary= bin;
+    mapped= map;
+    return true;
+  }
+
+  void ParallelReader::close() {
+    stop();
+    scanner.close();
+    for(std::vector<LAMMPSReader*>::iterator it= workers.begin(); it < workers.end(); it++) {
+      delete *it;
+    }
+    workers.clear();
+    curfile= "";
+  }
+
+  bool ParallelReader::start(const std::string& s) {
+    properties= s;
+    next_seq= 0;
+    total= 0;
+    scan_done= false;
+    scan_failed= false;
+    failed= false;
+    //the id_order rows handed out so far, which every frame is padded to
+    front.id_rows= 0;
+    stopping= false;
+    //depth frames are shared by all the workers, which bounds the memory in use
+    for(size_t i= 0; i < depth; i++) {
+      free_frames.push_back(new Frame());
+    }
+    for(std::vector<LAMMPSReader*>::iterator it= workers.begin(); it < workers.end(); it++) {
+      (*it)->wrap= wrap;
+      (*it)->id_order= id_order;
+      (*it)->SetBinaryColumns(binary_columns);
+      threads.push_back(std::thread(&ParallelReader::workLoop, this, *it));
+    }
+    threads.push_back(std::thread(&ParallelReader::scanLoop, this));
+    return true;
+  }
+
+  void ParallelReader::stop() {
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      stopping= true;
+    }
+    cv.notify_all();
+    for(std::vector<std::thread>::iterator it= threads.begin(); it < threads.end(); it++) {
+      it->join();
+    }
+    threads.clear();
+    for(std::vector<Frame*>::iterator it= free_frames.begin(); it < free_frames.end(); it++) {
+      delete *it;
+    }
+    free_frames.clear();
+    for(std::map<size_t, Frame*>::iterator it= done.begin(); it != done.end(); it++) {
+      delete it->second;
+    }
+    done.clear();
+    jobs.clear();
+  }
+
+  void ParallelReader::scanLoop() {
+    //walks the headers, queueing up the offset of each frame
+    FrameInfo fi;
+    size_t seq= 0;
+    int status;
+    while((status= (binary ? scanner.ScanBinaryFrame(fi) : scanner.ScanTextFrame(fi))) == 1) {
+      std::unique_lock<std::mutex> lk(mtx);
+      cv.wait(lk, [this] { return stopping || jobs.size() < depth; });
+      if(stopping) {
+	return;
+      }
+      Job j;
+      j.seq= seq++;
+      j.offset= fi.offset;
+      jobs.push_back(j);
+      cv.notify_all();
+    }
+    //if the scan failed, the frames before the error are still delivered, and then it's reported
+    std::lock_guard<std::mutex> lk(mtx);
+    total= seq;
+    scan_done= true;
+    scan_failed= status < 0;
+    cv.notify_all();
+  }
+
+  void ParallelReader::workLoop(LAMMPSReader *r) {
+    while(true) {
+      std::unique_lock<std::mutex> lk(mtx);
+      cv.wait(lk, [this] { return stopping || (!jobs.empty() && !free_frames.empty()) || (scan_done && jobs.empty()); });
+      if(stopping || jobs.empty()) {
+	return;
+      }
+      Job j= jobs.front();
+      jobs.pop_front();
+      Frame *f= free_frames.back();
+      free_frames.pop_back();
+      cv.notify_all();
+      lk.unlock();
+
+      bool ok= r->seekTo(j.offset) && r->ReadFrame(properties, *f);
+
+      lk.lock();
+      if(!ok) {
+	//a NULL result tells the consumer that this frame couldn't be read
+	free_frames.push_back(f);
+	f= NULL;
+      }
+      done[j.seq]= f;
+      cv.notify_all();
+    }
+  }
+
+  bool ParallelReader::ReadFrame(const std::string& s, Frame& out) {
+    if(workers.empty()) {
+      std::cerr << "ParallelReader::ReadFrame() called while no file is open." << std::endl;
+      return false;
+    }
+    if(threads.empty()) {
+      start(s);
+    } else if(s != properties) {
+      std::cerr << "ERROR: ParallelReader::ReadFrame() was asked for '" << s << "', but it is already reading '" << properties << "'. Reopen the file to change the properties. (" << curfile << ")" << std::endl;
+      return false;
+    }
+    std::unique_lock<std::mutex> lk(mtx);
+    if(failed) {
+      return false;
+    }
+    cv.wait(lk, [this] { return done.count(next_seq) > 0 || (scan_done && next_seq >= total); });
+    std::map<size_t, Frame*>::iterator it= done.find(next_seq);
+    if(it == done.end()) {
+      //no more frames, or none past a damaged one, which the scanner has already reported
+      failed= scan_failed;
+      return false;
+    }
+    Frame *f= it->second;
+    done.erase(it);
+    if(!f) {
+      //the worker has already reported what went wrong
+      failed= true;
+      return false;
+    }
+    next_seq++;
+    //swapping hands the caller's old arrays back to the pool, to be reused
+    std::swap(out, *f);
+    free_frames.push_back(f);
+    if(id_order) {
+      front.fitIdRows(out);
+    }
+    cv.notify_all();
+    return true;
+  }
+
+  void ParallelReader::SetBinaryColumns(const std::string& s) {
+    binary_columns= s;
+  }
+
+  bool ParallelReader::ReadFrame(const std::string& s, Callback *c) {
+    if(!ReadFrame(s, current)) {
+      return false;
+    }
+    front.ReplayFrame(current, c);
+    return true;
+  }
+}
@@ -0,0 +1,99 @@
+/*
+    parallelreader.h
+    ParallelReader reads the frames of a LAMMPS dump file on several threads
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef PARALLELREADER_H
+#define PARALLELREADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lammpsreader.h"
+
+namespace LAMMPSReaderNS {
+
+  //one thread finds where each frame starts, a pool of workers parse the frames,
+  //and the frames are handed back in the order they appear in the file
+  class ParallelReader {
+  public:
+    bool wrap;
+    bool id_order;
+
+    //threads= 0 uses one worker per core, depth= 0 allows two frames in flight per worker
+    ParallelReader(int threads= 0, size_t depth= 0);
+    ~ParallelReader();
+
+    bool open(const std::string&, bool bin= false, bool map= false);
+    void close();
+
+    //the properties must be the same for every call between open() and close()
+    bool ReadFrame(const std::string&, Frame&);
+    bool ReadFrame(const std::string&, Callback *c);
+    //as LAMMPSReader::SetBinaryColumns(), and must also be called before the first ReadFrame()
+    void SetBinaryColumns(const std::string&);
+    //whether ReadFrame() stopped because a frame couldn't be read, rather than at the end of the file
+    bool error() const { return failed; }
+  private:
+    int nthreads;
+    size_t depth;
+    std::string curfile;
+    bool binary;
+    bool mapped;
+    std::string properties;
+    std::string binary_columns;
+
+    //scanner finds the frames, front is what callbacks see
+    LAMMPSReader scanner;
+    LAMMPSReader front;
+    std::vector<LAMMPSReader*> workers;
+    std::vector<std::thread> threads;
+    Frame current;
+
+    struct Job {
+      size_t seq;
+      int64_t offset;
+    };
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Job> jobs;
+    std::vector<Frame*> free_frames;
+    std::map<size_t, Frame*> done;
+    size_t next_seq;
+    size_t total;
+    bool scan_done;
+    //the scan stopped at a damaged frame, not at the end of the file
+    bool scan_failed;
+    bool failed;
+    bool stopping;
+
+    bool start(const std::string&);
+    void stop();
+    void scanLoop();
+    void workLoop(LAMMPSReader*);
+  };
+}
+
+#endif
@@ -0,0 +1,186 @@
+/*
+    readahead.cpp
+    ReadAheadBuf reads a stream ahead of its user on a background thread
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <vector>
+
+#include "readahead.h"
+
+namespace LAMMPSReaderNS {
+
+  ReadAheadBuf::ReadAheadBuf(std::streambuf *source, size_t d, size_t c) {
+    src= source;
+    //we need one chunk to read from while the next is being filled
+    depth= (d < 2) ? 2 : d;
+    chunk= (c < 4096) ? 4096 : c;
+    cur= NULL;
+    cur_start= 0;
+    next_start= 0;
+    at_end= false;
+    stopping= false;
+    for(size_t i= 0; i < depth; i++) {
+      empty.push_back(new std::vector<char>());
+      empty.back()->reserve(chunk);
+    }
+    start(src->pubseekoff(0, std::ios_base::cur, std::ios_base::in));
+  }
+
+  ReadAheadBuf::~ReadAheadBuf() {
+    stop();
+    delete cur;
+    for(std::deque<std::vector<char>*>::iterator it= full.begin(); it != full.end(); it++) {
+      delete *it;
+    }
+    for(std::vector<std::vector<char>*>::iterator it= empty.begin(); it < empty.end(); it++) {
+      delete *it;
+    }
+  }
+
+  void ReadAheadBuf::start(std::streamoff pos) {
+    //throws away anything already read, and starts reading again from pos
+    //the background thread must not be running
+    while(!full.empty()) {
+      empty.push_back(full.front());
+      full.pop_front();
+    }
+    if(cur) {
+      empty.push_back(cur);
+      cur= NULL;
+    }
+    setg(NULL, NULL, NULL);
+    src->pubseekpos(pos, std::ios_base::in);
+    cur_start= pos;
+    next_start= pos;
+    at_end= false;
+    stopping= false;
+    reader= std::thread(&ReadAheadBuf::fill, this);
+  }
+
+  void ReadAheadBuf::stop() {
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      stopping= true;
+    }
+    cv.notify_all();
+    if(reader.joinable()) {
+      reader.join();
+    }
+  }
+
+  void ReadAheadBuf::fill() {
+    //runs on the background thread, filling empty chunks until the source runs out
+    while(true) {
+      std::vector<char> *b;
+      {
+	std::unique_lock<std::mutex> lk(mtx);
+	cv.wait(lk, [this] { return stopping || !empty.empty(); });
+	if(stopping) {
+	  return;
+	}
+	b= empty.back();
+	empty.pop_back();
+      }
+      b->resize(chunk);
+      std::streamsize n= src->sgetn(&(*b)[0], chunk);
+      b->resize(n > 0 ? n : 0);
+      std::lock_guard<std::mutex> lk(mtx);
+      full.push_back(b);
+      if(n < static_cast<std::streamsize>(chunk)) {
+	at_end= true;
+      }
+      cv.notify_all();
+      if(at_end) {
+	return;
+      }
+    }
+  }
+
+  ReadAheadBuf::int_type ReadAheadBuf::underflow() {
+    if(gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    std::unique_lock<std::mutex> lk(mtx);
+    //hand the chunk we've finished with back to the background thread
+    if(cur) {
+      empty.push_back(cur);
+      cur= NULL;
+      cv.notify_all();
+    }
+    setg(NULL, NULL, NULL);
+    cv.wait(lk, [this] { return !full.empty() || at_end; });
+    if(full.empty()) {
+      return traits_type::eof();
+    }
+    cur= full.front();
+    full.pop_front();
+    cur_start= next_start;
+    next_start+= cur->size();
+    if(cur->empty()) {
+      return traits_type::eof();
+    }
+    char *b= &(*cur)[0];
+    setg(b, b, b + cur->size());
+    return traits_type::to_int_type(*gptr());
+  }
+
+  ReadAheadBuf::pos_type ReadAheadBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if(!(which & std::ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+    off_type here= cur ? cur_start + (gptr() - eback()) : next_start;
+    if(dir == std::ios_base::cur) {
+      //tellg() ends up here, so it mustn't disturb anything
+      if(off == 0) {
+	return pos_type(here);
+      }
+      return seekpos(pos_type(here + off), which);
+    } else if(dir == std::ios_base::beg) {
+      return seekpos(pos_type(off), which);
+    }
+    //we have to ask the source where the end is
+    stop();
+    pos_type end= src->pubseekoff(0, std::ios_base::end, std::ios_base::in);
+    if(end == pos_type(off_type(-1))) {
+      start(here);
+      return end;
+    }
+    start(off_type(end) + off);
+    return pos_type(off_type(end) + off);
+  }
+
+  ReadAheadBuf::pos_type ReadAheadBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    if(!(which & std::ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+    off_type target= pos;
+    if(target < 0) {
+      return pos_type(off_type(-1));
+    }
+    //a seek within the chunk we already have is free
+    if(cur && target >= cur_start && target <= cur_start + static_cast<off_type>(cur->size())) {
+      setg(eback(), eback() + (target - cur_start), egptr());
+      return pos;
+    }
+    stop();
+    start(target);
+    return pos;
+  }
+}
@@ -0,0 +1,70 @@
+/*
+    readahead.h
+    ReadAheadBuf reads a stream ahead of its user on a background thread
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+namespace LAMMPSReaderNS {
+
+  //a read only stream buffer which keeps up to depth chunks of its source
+  //read in advance, so that reading overlaps with whatever is done with the data
+  class ReadAheadBuf : public std::streambuf {
+  public:
+    ReadAheadBuf(std::streambuf *source, size_t depth, size_t chunk);
+    ~ReadAheadBuf();
+  protected:
+    int_type underflow();
+    pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode);
+    pos_type seekpos(pos_type, std::ios_base::openmode);
+  private:
+    std::streambuf *src;
+    size_t depth;
+    size_t chunk;
+
+    //cur is the chunk being read from, and starts at offset cur_start in the source
+    //the next chunk to arrive will start at next_start
+    std::vector<char> *cur;
+    std::streamoff cur_start;
+    std::streamoff next_start;
+
+    std::thread reader;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::vector<char>*> full;
+    std::vector<std::vector<char>*> empty;
+    bool at_end;
+    bool stopping;
+
+    void start(std::streamoff);
+    void stop();
+    void fill();
+  };
+}
+
+#endif
@@ -0,0 +1,296 @@
+/*
+    splitdumpreader.cpp
+    SplitDumpReader reads a dump written as one file per processor, on several threads
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <glob.h>
+
+#include "splitdumpreader.h"
+
+namespace LAMMPSReaderNS {
+
+  SplitDumpReader::SplitDumpReader(int threads) {
+    wrap= true;
+    id_order= false;
+    nthreads= threads;
+    if(nthreads <= 0) {
+      nthreads= std::thread::hardware_concurrency();
+    }
+    if(nthreads <= 0) {
+      nthreads= 1;
+    }
+    round= 0;
+    busy= 0;
+    merging= false;
+    stopping= false;
+    failed= false;
+    out= NULL;
+  }
+
+  SplitDumpReader::~SplitDumpReader() {
+    close();
+  }
+
+  bool SplitDumpReader::open(const std::string& pattern, bool bin, bool map) {
+    //LAMMPS replaces the % with the number of the processor which wrote each piece
+    size_t pct= pattern.find('%');
+    if(pct == std::string::npos) {
+      std::cerr << "ERROR: " << pattern << " has no % in it, so it doesn't name the pieces of a split dump." << std::endl;
+      return false;
+    }
+    std::string prefix= pattern.substr(0, pct);
+    std::string suffix= pattern.substr(pct + 1);
+    glob_t g;
+    if(glob((prefix + "*" + suffix).c_str(), 0, NULL, &g) != 0) {
+      std::cerr << "ERROR: No files match " << pattern << std::endl;
+      globfree(&g);
+      return false;
+    }
+    //the pieces are put in order of processor number, which the glob's sort doesn't do
+    std::vector<std::pair<long, std::string> > found;
+    for(size_t i= 0; i < g.gl_pathc; i++) {
+      std::string name= g.gl_pathv[i];
+      if(name.size() <= prefix.size() + suffix.size()) {
+	continue;
+      }
+      std::string num= name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+      if(num.find_first_not_of("0123456789") != std::string::npos) {
+	continue;
+      }
+      found.push_back(std::make_pair(atol(num.c_str()), name));
+    }
+    globfree(&g);
+    if(found.empty()) {
+      std::cerr << "ERROR: No files match " << pattern << std::endl;
+      return false;
+    }
+    std::sort(found.begin(), found.end());
+    std::vector<std::string> names;
+    for(size_t i= 0; i < found.size(); i++) {
+      names.push_back(found[i].second);
+    }
+    if(!open(names, bin, map)) {
+      return false;
+    }
+    front.curfile= pattern;
+    return true;
+  }
+
+  bool SplitDumpReader::open(const std::vector<std::string>& names, bool bin, bool map) {
+    close();
+    for(size_t i= 0; i < names.size(); i++) {
+      LAMMPSReader *r= new LAMMPSReader();
+      readers.push_back(r);
+      if(!r->open(names[i], bin, map)) {
+	close();
+	return false;
+      }
+      if(!binary_columns.empty()) {
+	r->SetBinaryColumns(binary_columns);
+      }
+    }
+    pieces= names;
+    parts.resize(names.size());
+    ok.assign(names.size(), 0);
+    start.assign(names.size() + 1, 0);
+    //front reads nothing itself, but its name is the one its errors give
+    front.curfile= names.empty() ? "" : names[0];
+    front.id_rows= 0;
+    properties= "";
+    stopping= false;
+    failed= false;
+    for(size_t t= 1; t < nworkers(); t++) {
+      pool.push_back(std::thread(&SplitDumpReader::workLoop, this, t));
+    }
+    return true;
+  }
+
+  void SplitDumpReader::close() {
+    stop();
+    for(std::vector<LAMMPSReader*>::iterator it= readers.begin(); it < readers.end(); it++) {
+      delete *it;
+    }
+    readers.clear();
+    pieces.clear();
+    parts.clear();
+  }
+
+  size_t SplitDumpReader::nworkers() const {
+    return std::min(readers.size(), static_cast<size_t>(nthreads));
+  }
+
+  void SplitDumpReader::stop() {
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      stopping= true;
+    }
+    cv.notify_all();
+    for(std::vector<std::thread>::iterator it= pool.begin(); it < pool.end(); it++) {
+      it->join();
+    }
+    pool.clear();
+    //the threads open() starts next begin from round 0, so nothing may be left of this pool's rounds
+    round= 0;
+    busy= 0;
+    merging= false;
+  }
+
+  void SplitDumpReader::workLoop(size_t t) {
+    //waits for each round of work, does thread t's share of it, and says when it's done
+    size_t seen= 0;
+    while(true) {
+      bool merge;
+      {
+	std::unique_lock<std::mutex> lk(mtx);
+	cv.wait(lk, [&] { return stopping || round != seen; });
+	if(stopping) {
+	  return;
+	}
+	seen= round;
+	merge= merging;
+      }
+      work(t, merge);
+      std::lock_guard<std::mutex> lk(mtx);
+      if(--busy == 0) {
+	cv.notify_all();
+      }
+    }
+  }
+
+  void SplitDumpReader::runAll(bool merge) {
+    //hands out a round of work, does thread 0's share here, and waits for the rest
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      merging= merge;
+      busy= pool.size();
+      round++;
+    }
+    cv.notify_all();
+    work(0, merge);
+    std::unique_lock<std::mutex> lk(mtx);
+    cv.wait(lk, [this] { return busy == 0; });
+  }
+
+  void SplitDumpReader::work(size_t t, bool merge) {
+    //piece i is read by thread i % n, and then copied into place by the same thread
+    size_t n= nworkers();
+    for(size_t i= t; i < readers.size(); i+= n) {
+      if(!merge) {
+	readers[i]->wrap= wrap;
+	ok[i]= readers[i]->ReadFrame(properties, parts[i]);
+	continue;
+      }
+      for(std::vector<LAMMPSReader::PlanEntry>::const_iterator it= front.plan.begin(); it < front.plan.end(); it++) {
+	if(it->icol) {
+	  const std::vector<int>& col= parts[i].*(it->icol);
+	  std::copy(col.begin(), col.begin() + parts[i].size(), (out->*(it->icol)).begin() + start[i]);
+	} else {
+	  const std::vector<double>& col= parts[i].*(it->dcol);
+	  std::copy(col.begin(), col.begin() + parts[i].size(), (out->*(it->dcol)).begin() + start[i]);
+	}
+      }
+    }
+  }
+
+  void SplitDumpReader::SetBinaryColumns(const std::string& s) {
+    binary_columns= s;
+    for(std::vector<LAMMPSReader*>::iterator it= readers.begin(); it < readers.end(); it++) {
+      (*it)->SetBinaryColumns(s);
+    }
+  }
+
+  bool SplitDumpReader::ReadFrame(const std::string& s, Frame& f) {
+    if(readers.empty()) {
+      std::cerr << "SplitDumpReader::ReadFrame() called while no files are open." << std::endl;
+      return false;
+    }
+    if(failed) {
+      return false;
+    }
+    if(s != properties) {
+      //front's plan says which columns a frame has, for merging and for ordering by id
+      std::vector<std::string> args= explode(s);
+      if(!front.CompilePlan(args, args)) {
+	return false;
+      }
+      properties= s;
+    }
+    runAll(false);
+
+    size_t nok= std::count(ok.begin(), ok.end(), 1);
+    if(nok == 0) {
+      //every piece has ended
+      return false;
+    }
+    if(nok < readers.size()) {
+      size_t ended= std::find(ok.begin(), ok.end(), 0) - ok.begin();
+      size_t going= std::find(ok.begin(), ok.end(), 1) - ok.begin();
+      std::cerr << "ERROR: " << pieces[ended] << " has no more frames, but " << pieces[going] << " goes on to timestep " << parts[going].timestep << "; the pieces of a dump must hold the same frames." << std::endl;
+      failed= true;
+      return false;
+    }
+    for(size_t i= 0; i < readers.size(); i++) {
+      if(parts[i].timestep != parts[0].timestep) {
+	std::cerr << "ERROR: The pieces of the dump are out of step: " << pieces[0] << " is at timestep " << parts[0].timestep << ", but " << pieces[i] << " is at timestep " << parts[i].timestep << "." << std::endl;
+	failed= true;
+	return false;
+      }
+      start[i+1]= start[i] + parts[i].size();
+    }
+
+    //every piece has the same box, and the whole frame has all of their atoms
+    f.timestep= parts[0].timestep;
+    f.n_atoms= start.back();
+    f.n_rows= -1;
+    memcpy(f.boundaries, parts[0].boundaries, sizeof(f.boundaries));
+    for(int i= 0; i < 3; i++) {
+      f.box_lo[i]= parts[0].box_lo[i];
+      f.box_hi[i]= parts[0].box_hi[i];
+    }
+    front.sizeColumns(f, f.n_atoms);
+    out= &f;
+    runAll(true);
+    out= NULL;
+    if(id_order && !front.orderById(f)) {
+      failed= true;
+      return false;
+    }
+    return true;
+  }
+
+  bool SplitDumpReader::ReadFrame(const std::string& s, Callback *c) {
+    if(!ReadFrame(s, current)) {
+      return false;
+    }
+    front.ReplayFrame(current, c);
+    return true;
+  }
+}
@@ -0,0 +1,97 @@
+/*
+    splitdumpreader.h
+    SplitDumpReader reads a dump written as one file per processor, on several threads
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef SPLITDUMPREADER_H
+#define SPLITDUMPREADER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lammpsreader.h"
+
+namespace LAMMPSReaderNS {
+
+  //a dump written with a % in its name is split into one piece per processor (or group
+  //of processors), each holding its share of the atoms of every frame
+  //the pieces are read side by side, on several threads, and each frame is put back together
+  class SplitDumpReader {
+  public:
+    bool wrap;
+    bool id_order;
+
+    //threads= 0 uses one thread per core, but never more than there are pieces
+    SplitDumpReader(int threads= 0);
+    ~SplitDumpReader();
+
+    //the name given to the dump command, such as "dump.%.lammpstrj", or the pieces themselves,
+    //in order; the atoms of the first piece come first in each frame
+    bool open(const std::string& pattern, bool bin= false, bool map= false);
+    bool open(const std::vector<std::string>& pieces, bool bin= false, bool map= false);
+    void close();
+
+    //the callback version makes one StartOfTimestep() and EndOfTimestep() per frame, not per piece
+    bool ReadFrame(const std::string&, Frame&);
+    bool ReadFrame(const std::string&, Callback *c);
+    //as LAMMPSReader::SetBinaryColumns(), for every piece, now and after the next open()
+    void SetBinaryColumns(const std::string&);
+    //whether ReadFrame() stopped because the pieces couldn't be put together, rather than
+    //because every piece had ended
+    bool error() const { return failed; }
+
+    const std::vector<std::string>& Pieces() const { return pieces; }
+  private:
+    int nthreads;
+    std::vector<std::string> pieces;
+    std::vector<LAMMPSReader*> readers;
+    //each piece's share of the frame being read
+    std::vector<Frame> parts;
+    std::string properties;
+    std::string binary_columns;
+    //front puts the atoms in order of id, and is what callbacks see
+    LAMMPSReader front;
+    Frame current;
+    //the pieces are shared between the caller's thread and a pool kept from open() to close(),
+    //which is woken twice a frame: once to read the pieces, and once to merge them into out
+    std::vector<std::thread> pool;
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t round;
+    size_t busy;
+    bool merging;
+    bool stopping;
+    bool failed;
+    Frame *out;
+    std::vector<char> ok;
+    std::vector<size_t> start;
+    size_t nworkers() const;
+    void runAll(bool merge);
+    void workLoop(size_t t);
+    void work(size_t t, bool merge);
+    void stop();
+  };
+}
+
+#endif
@@ -0,0 +1,949 @@
+/*check.cpp
+  Reads the same trajectory through every path LAMMPSReader has, and checks that they agree
+  Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+  This program contains no LAMMPS source code.
+  More LAMMPS information may be found at http://lammps.sandia.gov
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <glob.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <columnar.h>
+#include <lammpsreader.h>
+#include <lammpswriter.h>
+#include <numparse.h>
+#include <parallelreader.h>
+#include <splitdumpreader.h>
+#include <trajectoryset.h>
+
+using namespace LAMMPSReaderNS;
+
+//every dump written here has these columns, and every path reads all of them
+static const char *columns= "id type x y z vx";
+static const double box= 10.0;
+//a reading path which hangs is a failure too, so the whole run is given this long
+static const unsigned int time_limit= 300;
+
+//every allocation in the program goes through these, so that steady-state reading can be checked
+//new and delete call a matching pair of functions, kept out of line so that the compiler
+//doesn't see free() being given memory from operator new
+static std::atomic<int64_t> allocations(0);
+
+__attribute__((noinline)) static void* counted_alloc(size_t n) {
+  allocations++;
+  void *p= std::malloc(n ? n : 1);
+  if(!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+__attribute__((noinline)) static void counted_free(void *p) {
+  std::free(p);
+}
+
+void* operator new(size_t n) {
+  return counted_alloc(n);
+}
+
+void* operator new[](size_t n) {
+  return counted_alloc(n);
+}
+
+void operator delete(void *p) noexcept {
+  counted_free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  counted_free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  counted_free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  counted_free(p);
+}
+
+static int checks= 0;
+static int failures= 0;
+static std::string dir;
+
+static void check(bool ok, const std::string& what) {
+  checks++;
+  if(!ok) {
+    failures++;
+    std::cout << "FAIL " << what << std::endl;
+  }
+}
+
+static std::string path(const std::string& name) {
+  return dir + "/" + name;
+}
+
+//a small generator, so that every run writes exactly the same dumps
+struct Random {
+  uint64_t state;
+  Random(uint64_t seed) : state(seed) {}
+  uint64_t next() {
+    state= state*6364136223846793005ULL + 1442695040888963407ULL;
+    return state >> 33;
+  }
+  double uniform(double lo, double hi) {
+    return lo + (hi - lo)*(next() % 1000000)/1000000.0;
+  }
+};
+
+//writes a text dump of nframes frames of natoms atoms, and returns the frames as they
+//should be read: parsed as strtod() would, and with the positions wrapped into the box
+static std::vector<Frame> write_text(const std::string& filename, int nframes, int natoms, uint64_t seed) {
+  Random rng(seed);
+  std::vector<Frame> frames(nframes);
+  std::ofstream out(filename.c_str());
+  std::vector<int> ids(natoms);
+  char buf[64];
+  for(int f= 0; f < nframes; f++) {
+    Frame& fr= frames[f];
+    fr.timestep= 100*f;
+    fr.n_atoms= natoms;
+    for(int d= 0; d < 3; d++) {
+      fr.boundaries[d][0]= fr.boundaries[d][1]= 'p';
+      fr.box_lo[d]= 0.0;
+      fr.box_hi[d]= box;
+    }
+    out << "ITEM: TIMESTEP\n" << fr.timestep << "\nITEM: NUMBER OF ATOMS\n" << natoms << "\n";
+    out << "ITEM: BOX BOUNDS pp pp pp\n0 10\n0 10\n0 10\nITEM: ATOMS " << columns << "\n";
+    //the atoms come in a different order in every frame, as they do from LAMMPS
+    for(int i= 0; i < natoms; i++) {
+      ids[i]= i + 1;
+    }
+    for(int i= natoms - 1; i > 0; i--) {
+      std::swap(ids[i], ids[rng.next() % (i + 1)]);
+    }
+    for(int i= 0; i < natoms; i++) {
+      fr.id.push_back(ids[i]);
+      fr.type.push_back(1 + ids[i] % 3);
+      out << fr.id[i] << " " << fr.type[i];
+      std::vector<double> *dcols[]= {&fr.x, &fr.y, &fr.z, &fr.vx};
+      for(int c= 0; c < 4; c++) {
+	//a few positions lie just outside the box, so that wrapping has something to do
+	double v= c < 3 ? rng.uniform(-0.5, box + 0.5) : rng.uniform(-3.0, 3.0);
+	snprintf(buf, sizeof(buf), "%.9g", v);
+	v= strtod(buf, NULL);
+	if(c < 3 && v < 0.0) {
+	  v+= box;
+	} else if(c < 3 && v >= box) {
+	  v-= box;
+	}
+	dcols[c]->push_back(v);
+	out << " " << buf;
+      }
+      out << "\n";
+    }
+  }
+  return frames;
+}
+
+static bool gzip_file(const std::string& from, const std::string& to) {
+  std::ifstream in(from.c_str(), std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  gzFile gz= gzopen(to.c_str(), "wb");
+  if(!gz) {
+    return false;
+  }
+  bool ok= gzwrite(gz, data.data(), data.size()) == static_cast<int>(data.size());
+  return gzclose(gz) == Z_OK && ok;
+}
+
+//copies from to to, leaving off its last n bytes, as a dump cut off part way through a frame would be
+static bool cut_file(const std::string& from, const std::string& to, size_t n) {
+  std::ifstream in(from.c_str(), std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::ofstream out(to.c_str(), std::ios::binary);
+  out.write(data.data(), data.size() - n);
+  out.close();
+  return data.size() > n && out.good();
+}
+
+static bool write_frames(const std::string& filename, const std::vector<Frame>& frames, bool bin, int precision= 17) {
+  LAMMPSWriter w;
+  w.precision= precision;
+  if(!w.open(filename, columns, bin)) {
+    return false;
+  }
+  for(size_t i= 0; i < frames.size(); i++) {
+    if(!w.WriteFrame(frames[i])) {
+      return false;
+    }
+  }
+  return w.close();
+}
+
+//copies a text dump, with blank and whitespace-only lines among the atoms of every frame,
+//including straight after ITEM: ATOMS and every few thousand atoms, where threads split the frame
+static bool add_blank_lines(const std::string& from, const std::string& to) {
+  std::ifstream in(from.c_str());
+  std::ofstream out(to.c_str());
+  std::string line;
+  int atom= -1;
+  while(std::getline(in, line)) {
+    if(line.compare(0, 6, "ITEM: ") == 0) {
+      atom= line.compare(0, 11, "ITEM: ATOMS") == 0 ? 0 : -1;
+      out << line << "\n";
+      if(atom == 0) {
+	out << "\n";
+      }
+      continue;
+    }
+    out << line << "\n";
+    if(atom >= 0 && ++atom % 4999 == 0) {
+      out << (atom % 2 ? " \t\n" : "\n");
+    }
+  }
+  out.close();
+  return !in.bad() && out.good();
+}
+
+//copies a binary dump, giving every frame an empty processor block after its last one,
+//as LAMMPS writes for a processor which holds no atoms
+static bool add_empty_blocks(const std::string& from, const std::string& to) {
+  std::ifstream in(from.c_str(), std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::string out;
+  //timestep, atoms, triclinic, boundaries and box, then the columns and the number of blocks
+  const size_t header= 2*sizeof(int64_t) + 8*sizeof(int) + 6*sizeof(double);
+  size_t pos= 0;
+  while(pos < data.size()) {
+    if(pos + header + sizeof(int) > data.size()) {
+      return false;
+    }
+    int nblocks;
+    memcpy(&nblocks, &data[pos + header], sizeof(int));
+    int more= nblocks + 1;
+    out.append(data, pos, header);
+    out.append(reinterpret_cast<const char*>(&more), sizeof(int));
+    pos+= header + sizeof(int);
+    for(int b= 0; b < nblocks; b++) {
+      int n;
+      if(pos + sizeof(int) > data.size()) {
+	return false;
+      }
+      memcpy(&n, &data[pos], sizeof(int));
+      out.append(data, pos, sizeof(int) + n*sizeof(double));
+      pos+= sizeof(int) + n*sizeof(double);
+    }
+    int none= 0;
+    out.append(reinterpret_cast<const char*>(&none), sizeof(int));
+  }
+  std::ofstream o(to.c_str(), std::ios::binary);
+  o.write(out.data(), out.size());
+  return !o.fail();
+}
+
+//two frames match if their headers and every column they were read with are the same, exactly
+static bool same(const Frame& a, const Frame& b) {
+  if(a.timestep != b.timestep || a.n_atoms != b.n_atoms) {
+    return false;
+  }
+  for(int d= 0; d < 3; d++) {
+    if(a.box_lo[d] != b.box_lo[d] || a.box_hi[d] != b.box_hi[d]) {
+      return false;
+    }
+  }
+  std::vector<std::string> names= explode(columns);
+  for(size_t i= 0; i < names.size(); i++) {
+    const PropertySlot *slot= FindProperty(names[i]);
+    if(slot->icol ? a.*slot->icol != b.*slot->icol : a.*slot->dcol != b.*slot->dcol) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool same(const std::vector<Frame>& a, const std::vector<Frame>& b) {
+  if(a.size() != b.size()) {
+    return false;
+  }
+  for(size_t i= 0; i < a.size(); i++) {
+    if(!same(a[i], b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//rebuilds frames from the callbacks, so they can be compared with the Frame paths
+class Collector : public Callback {
+public:
+  std::vector<Frame> frames;
+  void StartOfTimestep(LAMMPSReader*) {
+    frames.push_back(Frame());
+  }
+  //a text frame's timestep is only read after StartOfTimestep()
+  void EndOfTimestep(LAMMPSReader *r) {
+    frames.back().timestep= r->last_tstep;
+  }
+  void BoxBounds(char b[3][2], double lo[3], double hi[3]) {
+    Frame& f= frames.back();
+    memcpy(f.boundaries, b, sizeof(f.boundaries));
+    for(int d= 0; d < 3; d++) {
+      f.box_lo[d]= lo[d];
+      f.box_hi[d]= hi[d];
+    }
+  }
+  void AtomLine(const AtomData& ad, LAMMPSReader*) {
+    Frame& f= frames.back();
+    f.id.push_back(ad.id);
+    f.type.push_back(ad.type);
+    f.x.push_back(ad.x);
+    f.y.push_back(ad.y);
+    f.z.push_back(ad.z);
+    f.vx.push_back(ad.vx);
+    f.n_atoms++;
+  }
+};
+
+//a reader opened on one of the test files, binary ones with their column layout
+static bool open_reader(LAMMPSReader& r, const std::string& filename, bool bin, bool map) {
+  if(!r.open(filename, bin, map)) {
+    return false;
+  }
+  if(bin) {
+    r.SetBinaryColumns(columns);
+  }
+  return true;
+}
+
+static std::vector<Frame> read_frames(LAMMPSReader& r) {
+  std::vector<Frame> frames;
+  Frame f;
+  while(r.ReadFrame(columns, f)) {
+    frames.push_back(f);
+  }
+  return frames;
+}
+
+static std::vector<Frame> read_frames(const std::string& filename, bool bin, bool map, int threads= 1) {
+  LAMMPSReader r;
+  r.threads= threads;
+  if(!open_reader(r, filename, bin, map)) {
+    return std::vector<Frame>();
+  }
+  return read_frames(r);
+}
+
+static std::vector<Frame> read_callbacks(const std::string& filename, bool bin, bool map) {
+  LAMMPSReader r;
+  Collector c;
+  if(open_reader(r, filename, bin, map)) {
+    while(r.ReadFrame(columns, &c)) {
+    }
+  }
+  return c.frames;
+}
+
+static std::vector<Frame> read_records(const std::string& filename, bool bin, bool map) {
+  using namespace Fields;
+  LAMMPSReader r;
+  Collector c;
+  if(!open_reader(r, filename, bin, map)) {
+    return c.frames;
+  }
+  Frame f;
+  while(r.ReadFrame<id, type, x, y, z, vx>([&](const Record<id, type, x, y, z, vx>& a) {
+	f.id.push_back(a.id);
+	f.type.push_back(a.type);
+	f.x.push_back(a.x);
+	f.y.push_back(a.y);
+	f.z.push_back(a.z);
+	f.vx.push_back(a.vx);
+      })) {
+    f.timestep= r.last_tstep;
+    f.n_atoms= f.id.size();
+    memcpy(f.boundaries, r.boundaries, sizeof(f.boundaries));
+    for(int d= 0; d < 3; d++) {
+      f.box_lo[d]= r.box_lo[d];
+      f.box_hi[d]= r.box_hi[d];
+    }
+    c.frames.push_back(f);
+    f= Frame();
+  }
+  return c.frames;
+}
+
+//the frames which a filter on x in [lo, hi] should leave
+static std::vector<Frame> filter_x(const std::vector<Frame>& frames, double lo, double hi) {
+  std::vector<Frame> out(frames.size());
+  for(size_t i= 0; i < frames.size(); i++) {
+    const Frame& f= frames[i];
+    Frame& o= out[i];
+    o= f;
+    o.id.clear();
+    o.type.clear();
+    o.x.clear();
+    o.y.clear();
+    o.z.clear();
+    o.vx.clear();
+    for(size_t j= 0; j < f.size(); j++) {
+      if(f.x[j] >= lo && f.x[j] <= hi) {
+	o.id.push_back(f.id[j]);
+	o.type.push_back(f.type[j]);
+	o.x.push_back(f.x[j]);
+	o.y.push_back(f.y[j]);
+	o.z.push_back(f.z[j]);
+	o.vx.push_back(f.vx[j]);
+      }
+    }
+    o.n_atoms= o.id.size();
+  }
+  return out;
+}
+
+//reads the file as nshards shards, one after the other, and puts their frames back together
+static std::vector<Frame> read_shards(const std::string& filename, bool bin, bool map, int nshards) {
+  std::vector<Frame> frames;
+  for(int s= 0; s < nshards; s++) {
+    LAMMPSReader r;
+    int64_t begin, end;
+    if(!open_reader(r, filename, bin, map) || !r.ShardRange(nshards, s, begin, end) || !r.SetRange(begin, end)) {
+      return std::vector<Frame>();
+    }
+    std::vector<Frame> part= read_frames(r);
+    frames.insert(frames.end(), part.begin(), part.end());
+  }
+  return frames;
+}
+
+//every path through LAMMPSReader, on one file, against the frames it should give
+static void check_paths(const std::string& name, const std::string& filename, bool bin, const std::vector<Frame>& expected) {
+  bool compressed= filename.size() > 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0;
+  check(same(read_frames(filename, bin, false), expected), name + ": frames");
+  check(same(read_callbacks(filename, bin, false), expected), name + ": callbacks");
+  check(same(read_records(filename, bin, false), expected), name + ": ReadFrame<...>()");
+  if(!compressed) {
+    check(same(read_frames(filename, bin, true), expected), name + ": frames, mapped");
+    check(same(read_callbacks(filename, bin, true), expected), name + ": callbacks, mapped");
+    //frames of 65536 atoms or more are split between the threads
+    check(same(read_frames(filename, bin, !bin, 4), expected), name + ": frames, 4 threads");
+  }
+  {
+    LAMMPSReader r;
+    check(open_reader(r, filename, bin, false) && r.EnablePrefetch(2, 4096) && same(read_frames(r), expected), name + ": frames, prefetch");
+  }
+
+  //filters, through both Frames and callbacks
+  std::vector<Frame> filtered= filter_x(expected, 2.0, 5.0);
+  {
+    LAMMPSReader r;
+    open_reader(r, filename, bin, false);
+    r.AddFilter("x", 2.0, 5.0);
+    check(same(read_frames(r), filtered), name + ": frames, filtered");
+  }
+  {
+    LAMMPSReader r;
+    Collector c;
+    open_reader(r, filename, bin, false);
+    r.AddFilter("x", 2.0, 5.0);
+    while(r.ReadFrame(columns, &c)) {
+    }
+    check(same(c.frames, filtered), name + ": callbacks, filtered");
+  }
+  {
+    //a filter which keeps nothing still gives every frame, with no atoms
+    LAMMPSReader r;
+    Collector c;
+    open_reader(r, filename, bin, false);
+    r.AddFilter("x", -2.0, -1.0);
+    while(r.ReadFrame(columns, &c)) {
+    }
+    check(same(c.frames, filter_x(expected, -2.0, -1.0)), name + ": callbacks, everything filtered out");
+  }
+
+  //every other frame
+  {
+    LAMMPSReader r;
+    open_reader(r, filename, bin, false);
+    r.stride= 2;
+    std::vector<Frame> every_other;
+    for(size_t i= 0; i < expected.size(); i+= 2) {
+      every_other.push_back(expected[i]);
+    }
+    check(same(read_frames(r), every_other), name + ": stride 2");
+  }
+
+  //seeking, with the index
+  {
+    LAMMPSReader r;
+    bool ok= open_reader(r, filename, bin, false) && r.BuildIndex(false) && r.Index().size() == expected.size();
+    for(size_t k= expected.size(); ok && k-- > 0; ) {
+      Frame f;
+      ok= r.SeekFrame(k) && r.ReadFrame(columns, f) && same(f, expected[k]);
+    }
+    check(ok, name + ": SeekFrame(), backwards");
+  }
+
+  //skipping to exactly the end succeeds, and then there's nothing left to read
+  for(int indexed= 0; indexed < 2; indexed++) {
+    std::string how= indexed ? " with an index" : "";
+    LAMMPSReader r;
+    Frame f;
+    bool ok= open_reader(r, filename, bin, false) && (!indexed || r.BuildIndex(false)) && r.ReadFrame(columns, f);
+    check(ok && r.SkipFrames(expected.size() - 1) && !r.ReadFrame(columns, f), name + ": SkipFrames() to the end" + how);
+    LAMMPSReader q;
+    ok= open_reader(q, filename, bin, false) && (!indexed || q.BuildIndex(false)) && q.ReadFrame(columns, f);
+    check(ok && !q.SkipFrames(expected.size()) && !q.ReadFrame(columns, f), name + ": SkipFrames() past the end" + how);
+  }
+
+  //shards, including more shards than frames
+  int nshards[]= {1, 2, 3, 4, static_cast<int>(expected.size()) + 3};
+  for(size_t i= 0; i < sizeof(nshards)/sizeof(nshards[0]); i++) {
+    std::ostringstream what;
+    what << name << ": " << nshards[i] << " shards";
+    check(same(read_shards(filename, bin, false, nshards[i]), expected), what.str());
+    if(!compressed) {
+      check(same(read_shards(filename, bin, true, nshards[i]), expected), what.str() + ", mapped");
+    }
+  }
+  {
+    //a range running past the end of the file stops at the end
+    LAMMPSReader r;
+    check(open_reader(r, filename, bin, false) && r.SetRange(0, INT64_C(1) << 40) && same(read_frames(r), expected), name + ": SetRange() past the end");
+  }
+}
+
+static void check_id_order(const std::string& filename, const std::vector<Frame>& expected) {
+  //with id_order, the atom with id i is in row i-1, and rows without an atom have id 0;
+  //the filter leaves out different atoms in each frame, including the largest ids, but
+  //every frame keeps the same rows, and n_atoms is still the number of atoms
+  LAMMPSReader r;
+  r.open(filename);
+  r.id_order= true;
+  r.AddFilter("x", 2.0, 5.0);
+  std::vector<Frame> frames;
+  Frame f;
+  bool ok= true;
+  size_t kept= 0;
+  while(r.ReadFrame(columns, f)) {
+    size_t atoms= 0;
+    for(size_t i= 0; i < f.size(); i++) {
+      if(f.id[i] == 0) {
+	ok= ok && f.x[i] == 0.0;
+	continue;
+      }
+      ok= ok && f.id[i] == static_cast<int>(i) + 1 && f.x[i] >= 2.0 && f.x[i] <= 5.0;
+      atoms++;
+    }
+    ok= ok && f.n_atoms == static_cast<int64_t>(atoms) && (frames.empty() || f.size() == frames[0].size());
+    kept+= atoms;
+    frames.push_back(f);
+  }
+  std::vector<Frame> filtered= filter_x(expected, 2.0, 5.0);
+  size_t want= 0;
+  for(size_t i= 0; i < filtered.size(); i++) {
+    want+= filtered[i].size();
+  }
+  check(ok && frames.size() == expected.size() && kept == want, "id_order: rows are ids, with filters");
+
+  //after the first frame the atoms with the largest ids leave, so a ParallelReader worker
+  //which didn't read the first frame sees fewer rows, but the frames must still line up
+  std::vector<Frame> leaving(expected);
+  for(size_t k= 1; k < leaving.size(); k++) {
+    Frame& l= leaving[k];
+    size_t w= 0;
+    for(size_t i= 0; i < l.size(); i++) {
+      if(l.id[i] <= 400) {
+	l.id[w]= l.id[i];
+	l.type[w]= l.type[i];
+	l.x[w]= l.x[i];
+	l.y[w]= l.y[i];
+	l.z[w]= l.z[i];
+	l.vx[w]= l.vx[i];
+	w++;
+      }
+    }
+    l.n_atoms= w;
+    l.id.resize(w);
+    l.type.resize(w);
+    l.x.resize(w);
+    l.y.resize(w);
+    l.z.resize(w);
+    l.vx.resize(w);
+  }
+  ok= write_frames(path("leaving.txt"), leaving, false);
+  LAMMPSReader q;
+  q.id_order= true;
+  frames.clear();
+  if(ok && q.open(path("leaving.txt"))) {
+    while(q.ReadFrame(columns, f)) {
+      ok= ok && f.size() == expected[0].size();
+      frames.push_back(f);
+    }
+  }
+  ParallelReader pr(3);
+  pr.id_order= true;
+  std::vector<Frame> parallel;
+  if(ok && pr.open(path("leaving.txt"))) {
+    while(pr.ReadFrame(columns, f)) {
+      parallel.push_back(f);
+    }
+  }
+  ok= ok && frames.size() == expected.size() && parallel.size() == frames.size();
+  for(size_t i= 0; ok && i < frames.size(); i++) {
+    ok= same(parallel[i], frames[i]) && parallel[i].size() == frames[i].size();
+  }
+  check(ok, "id_order: rows kept as atoms leave, and ParallelReader gives the same rows");
+}
+
+static void check_split(const std::vector<Frame>& expected) {
+  //the atoms of each frame are dealt out between three pieces, as LAMMPS does with a % in the name
+  const int npieces= 3;
+  for(int bin= 0; bin < 2; bin++) {
+    std::string suffix= bin ? ".bin" : ".txt";
+    bool ok= true;
+    for(int p= 0; p < npieces; p++) {
+      std::vector<Frame> piece(expected);
+      for(size_t i= 0; i < piece.size(); i++) {
+	size_t first= expected[i].size()*p/npieces;
+	size_t last= expected[i].size()*(p + 1)/npieces;
+	Frame& f= piece[i];
+	std::vector<int> Frame::*icols[]= {&Frame::id, &Frame::type};
+	std::vector<double> Frame::*dcols[]= {&Frame::x, &Frame::y, &Frame::z, &Frame::vx};
+	for(int c= 0; c < 2; c++) {
+	  (f.*icols[c]).assign((expected[i].*icols[c]).begin() + first, (expected[i].*icols[c]).begin() + last);
+	}
+	for(int c= 0; c < 4; c++) {
+	  (f.*dcols[c]).assign((expected[i].*dcols[c]).begin() + first, (expected[i].*dcols[c]).begin() + last);
+	}
+	f.n_atoms= last - first;
+      }
+      std::ostringstream name;
+      name << "split." << p << suffix;
+      ok= ok && write_frames(path(name.str()), piece, bin);
+    }
+    SplitDumpReader sr(2);
+    //the layout is given before open(), as it can be for ParallelReader
+    sr.SetBinaryColumns(columns);
+    ok= ok && sr.open(path("split.%" + suffix), bin);
+    std::vector<Frame> frames;
+    Frame f;
+    while(ok && sr.ReadFrame(columns, f)) {
+      frames.push_back(f);
+    }
+    check(ok && same(frames, expected) && !sr.error(), std::string("SplitDumpReader, ") + (bin ? "binary" : "text"));
+    //reopened, its new threads must wait for the first frame to be asked for, however long that takes
+    ok= ok && sr.open(path("split.%" + suffix), bin);
+    usleep(100000);
+    frames.clear();
+    while(ok && sr.ReadFrame(columns, f)) {
+      frames.push_back(f);
+    }
+    check(ok && same(frames, expected), std::string("SplitDumpReader, reopened, ") + (bin ? "binary" : "text"));
+  }
+  //the last piece cut off part way through its last frame, so the others go on without it
+  SplitDumpReader sr(2);
+  std::vector<std::string> pieces;
+  pieces.push_back(path("split.0.txt"));
+  pieces.push_back(path("split.1.txt"));
+  pieces.push_back(path("cutsplit.2.txt"));
+  std::vector<Frame> frames;
+  Frame f;
+  if(cut_file(path("split.2.txt"), path("cutsplit.2.txt"), 100) && sr.open(pieces)) {
+    while(sr.ReadFrame(columns, f)) {
+      frames.push_back(f);
+    }
+  }
+  std::vector<Frame> before(expected.begin(), expected.end() - 1);
+  check(same(frames, before) && sr.error(), "SplitDumpReader, a damaged piece is an error");
+}
+
+//reads every frame with read_frame, and counts the allocations made after the first frame
+//the first frame sizes the reader's buffers, so anything allocated after it is a failure
+static void check_no_allocations(const std::string& name, const std::function<bool(LAMMPSReader&)>& open, const std::function<bool(LAMMPSReader&)>& read_frame) {
+  LAMMPSReader r;
+  bool ok= open(r) && read_frame(r);
+  int64_t before= allocations;
+  int frames= 0;
+  while(ok && read_frame(r)) {
+    frames++;
+  }
+  int64_t n= allocations - before;
+  std::ostringstream what;
+  what << name << ": no allocations after the first frame (" << n << " made)";
+  check(ok && frames > 0 && n == 0, what.str());
+}
+
+//counts the atoms it is given, without keeping them, so that it allocates nothing itself
+class Counter : public Callback {
+public:
+  size_t atoms;
+  Counter() : atoms(0) {}
+  void AtomLine(const AtomData&, LAMMPSReader*) {
+    atoms++;
+  }
+};
+
+static void check_allocations(const std::string& text, const std::string& bin) {
+  //reading with one thread, from text, mapped text and binary files, allocates nothing once
+  //the first frame has been read, and neither does LAMMPSWriter
+  using namespace Fields;
+  //the properties are kept in a string, as building one for every call would allocate
+  const std::string props(columns);
+  Counter c;
+  Frame f;
+  std::function<bool(LAMMPSReader&)> callbacks= [&](LAMMPSReader& r) {
+    return r.ReadFrame(props, &c);
+  };
+  std::function<bool(LAMMPSReader&)> frames= [&](LAMMPSReader& r) {
+    return r.ReadFrame(props, f);
+  };
+  std::function<bool(LAMMPSReader&)> records= [&](LAMMPSReader& r) {
+    return r.ReadFrame<id, x, y, z>([&](const Record<id, x, y, z>&) {
+	c.atoms++;
+      });
+  };
+  std::function<bool(LAMMPSReader&)> open_text= [&](LAMMPSReader& r) {
+    return open_reader(r, text, false, false);
+  };
+  std::function<bool(LAMMPSReader&)> open_mapped= [&](LAMMPSReader& r) {
+    return open_reader(r, text, false, true);
+  };
+  std::function<bool(LAMMPSReader&)> open_binary= [&](LAMMPSReader& r) {
+    return open_reader(r, bin, true, false);
+  };
+  check_no_allocations("text, callbacks", open_text, callbacks);
+  check_no_allocations("text, frames", open_text, frames);
+  check_no_allocations("text, ReadFrame<...>()", open_text, records);
+  check_no_allocations("mapped text, callbacks", open_mapped, callbacks);
+  check_no_allocations("mapped text, frames", open_mapped, frames);
+  check_no_allocations("mapped text, ReadFrame<...>()", open_mapped, records);
+  check_no_allocations("binary, callbacks", open_binary, callbacks);
+  check_no_allocations("binary, frames", open_binary, frames);
+  check_no_allocations("binary, ReadFrame<...>()", open_binary, records);
+
+  LAMMPSWriter w;
+  std::function<bool(LAMMPSReader&)> write_callbacks= [&](LAMMPSReader& r) {
+    return r.ReadFrame(props, &w) && w.good();
+  };
+  std::function<bool(LAMMPSReader&)> write_frames= [&](LAMMPSReader& r) {
+    return r.ReadFrame(props, f) && w.WriteFrame(f);
+  };
+  check(w.open(path("allocs.txt"), props), "opening a LAMMPSWriter");
+  check_no_allocations("text, LAMMPSWriter callbacks", open_text, write_callbacks);
+  check(w.open(path("allocs.bin"), props, true), "opening a LAMMPSWriter");
+  check_no_allocations("binary, LAMMPSWriter frames", open_binary, write_frames);
+  w.close();
+}
+
+static void check_parser() {
+  //ParseDouble() must agree exactly with strtod(), and bad numbers must be refused
+  const char *doubles[]= {"0", "-0", "1", "-2.5", "3.14159265358979", "1e-300", "2.2250738585072014e-308",
+    "4.9e-324", "1.7976931348623157e308", "123456789012345678901234567890", "0.1", "9007199254740993",
+    "1.00000000000000011102230246251565", "6.02214076e23", "-7.5E+02", ".5", "5.", "inf", "-infinity", "1e400"};
+  bool ok= true;
+  for(size_t i= 0; i < sizeof(doubles)/sizeof(doubles[0]); i++) {
+    double v;
+    const char *s= doubles[i];
+    ok= ok && ParseDouble(s, s + strlen(s), v) && v == strtod(s, NULL);
+  }
+  check(ok, "ParseDouble() agrees with strtod()");
+  const char *bad[]= {"", "-", "1.2.3", "12x", "e5", "1e", "--1", "0x10"};
+  ok= true;
+  for(size_t i= 0; i < sizeof(bad)/sizeof(bad[0]); i++) {
+    double v;
+    const char *s= bad[i];
+    ok= ok && !ParseDouble(s, s + strlen(s), v);
+  }
+  check(ok, "ParseDouble() refuses malformed numbers");
+  int iv;
+  int64_t lv;
+  const char *big= "2147483648";
+  const char *most= "-2147483648";
+  const char *huge= "9223372036854775807";
+  check(!ParseInt(big, big + strlen(big), iv), "ParseInt() refuses an int which overflows");
+  check(ParseInt(most, most + strlen(most), iv) && iv == -2147483647 - 1, "ParseInt() reads the most negative int");
+  check(ParseInt(huge, huge + strlen(huge), lv) && lv == INT64_C(9223372036854775807), "ParseInt() reads a 64 bit timestep");
+}
+
+static void remove_all() {
+  glob_t g;
+  if(glob(path("*").c_str(), 0, NULL, &g) == 0) {
+    for(size_t i= 0; i < g.gl_pathc; i++) {
+      remove(g.gl_pathv[i]);
+    }
+  }
+  globfree(&g);
+  rmdir(dir.c_str());
+}
+
+int main() {
+  alarm(time_limit);
+  char tmpl[]= "/tmp/lammpsreader-check.XXXXXX";
+  if(!mkdtemp(tmpl)) {
+    std::cerr << "ERROR: Couldn't make a directory for the test files." << std::endl;
+    return 1;
+  }
+  dir= tmpl;
+
+  //a small trajectory, in every form the reader takes
+  std::vector<Frame> expected= write_text(path("small.txt"), 6, 500, 1);
+  bool made= gzip_file(path("small.txt"), path("small.txt.gz")) && write_frames(path("small.bin"), expected, true)
+    && gzip_file(path("small.bin"), path("small.bin.gz"));
+  check(made, "writing the test files");
+  check_paths("text", path("small.txt"), false, expected);
+  check_paths("gzip text", path("small.txt.gz"), false, expected);
+  check_paths("binary", path("small.bin"), true, expected);
+  check_paths("gzip binary", path("small.bin.gz"), true, expected);
+
+  //LAMMPSWriter and columnar files give back exactly what they were given
+  check(write_frames(path("copy.txt"), expected, false) && same(read_frames(path("copy.txt"), false, false), expected), "LAMMPSWriter, text round trip");
+  {
+    ColumnarWriter cw;
+    bool ok= cw.open(path("small.col"), columns);
+    for(size_t i= 0; ok && i < expected.size(); i++) {
+      ok= cw.WriteFrame(expected[i]);
+    }
+    ok= ok && cw.close();
+    ColumnarReader cr;
+    ok= ok && cr.open(path("small.col")) && cr.Frames() == expected.size();
+    for(size_t i= 0; ok && i < expected.size(); i++) {
+      Frame f;
+      ok= cr.ReadFrame(i, f, columns);
+      f.timestep= cr.Info(i).timestep;
+      ok= ok && f.id == expected[i].id && f.x == expected[i].x && f.vx == expected[i].vx && f.type == expected[i].type;
+    }
+    check(ok, "columnar round trip");
+  }
+
+  //the readers built on LAMMPSReader
+  {
+    ParallelReader pr(3);
+    std::vector<Frame> frames;
+    Frame f;
+    if(pr.open(path("small.txt"), false, true)) {
+      while(pr.ReadFrame(columns, f)) {
+	frames.push_back(f);
+      }
+    }
+    check(same(frames, expected) && !pr.error(), "ParallelReader");
+  }
+  {
+    //a file cut off part way through its last frame gives the frames before it, and then an error
+    ParallelReader pr(3);
+    std::vector<Frame> frames;
+    Frame f;
+    if(cut_file(path("small.txt"), path("cut.txt"), 100) && pr.open(path("cut.txt"))) {
+      while(pr.ReadFrame(columns, f)) {
+	frames.push_back(f);
+      }
+    }
+    std::vector<Frame> before(expected.begin(), expected.end() - 1);
+    check(same(frames, before) && pr.error(), "ParallelReader, a damaged file is an error");
+  }
+  {
+    //the trajectory cut in two, as a run and its restart would write it
+    std::vector<Frame> first(expected.begin(), expected.begin() + 3);
+    std::vector<Frame> second(expected.begin() + 3, expected.end());
+    bool ok= write_frames(path("part.1.txt"), first, false) && write_frames(path("part.2.txt"), second, false);
+    TrajectorySet ts(2);
+    std::vector<Frame> frames;
+    Frame f;
+    if(ok && ts.open(path("part.*.txt"))) {
+      while(ts.ReadFrame(columns, f)) {
+	frames.push_back(f);
+      }
+    }
+    check(same(frames, expected) && !ts.error(), "TrajectorySet");
+  }
+  {
+    //the last atom of the restart's file has lost a column, which indexing doesn't see, as
+    //it only counts lines, but reading that frame does
+    std::ifstream in(path("part.2.txt").c_str(), std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream out(path("badpart.2.txt").c_str(), std::ios::binary);
+    out << data.substr(0, data.rfind(' ')) << "\n";
+    out.close();
+    std::vector<std::string> files;
+    files.push_back(path("part.1.txt"));
+    files.push_back(path("badpart.2.txt"));
+    TrajectorySet ts(2);
+    std::vector<Frame> frames;
+    Frame f;
+    if(out.good() && ts.open(files)) {
+      while(ts.ReadFrame(columns, f)) {
+	frames.push_back(f);
+      }
+    }
+    std::vector<Frame> before(expected.begin(), expected.end() - 1);
+    check(same(frames, before) && ts.error(), "TrajectorySet, a damaged file is an error");
+  }
+  {
+    //a restart from timestep 200 appended to the same file, with different atoms, replaces
+    //the frames from 200 on, as it would if it had been written to a file of its own
+    std::vector<Frame> restart= write_text(path("restart.txt"), 6, 500, 3);
+    std::vector<Frame> appended(expected.begin(), expected.begin() + 4);
+    appended.insert(appended.end(), restart.begin() + 2, restart.end());
+    std::vector<Frame> want(expected.begin(), expected.begin() + 2);
+    want.insert(want.end(), restart.begin() + 2, restart.end());
+    bool ok= write_frames(path("appended.txt"), appended, false);
+    TrajectorySet ts(2);
+    std::vector<Frame> frames;
+    Frame f;
+    if(ok && ts.open(path("appended.txt"))) {
+      while(ts.ReadFrame(columns, f)) {
+	frames.push_back(f);
+      }
+    }
+    check(same(frames, want), "TrajectorySet, a restart within one file keeps the later frames");
+  }
+  check_split(expected);
+  check_id_order(path("small.txt"), expected);
+
+  //frames big enough to be split between threads
+  std::vector<Frame> big= write_text(path("big.txt"), 2, 70000, 2);
+  check(write_frames(path("big.bin"), big, true), "writing the big test files");
+  check(same(read_frames(path("big.txt"), false, true, 4), big), "text, frames, mapped, 4 threads");
+  check(same(read_frames(path("big.bin"), true, false, 4), big), "binary, frames, 4 threads");
+  check(add_empty_blocks(path("big.bin"), path("big.empty.bin")) && same(read_frames(path("big.empty.bin"), true, false, 4), big), "binary, frames, 4 threads, empty last block");
+  check(same(read_callbacks(path("big.bin"), true, false), big), "binary, callbacks, big blocks");
+  check(add_blank_lines(path("big.txt"), path("blank.txt")), "writing the blank line test file");
+  check(same(read_frames(path("blank.txt"), false, true), big), "text with blank lines, frames, mapped");
+  check(same(read_frames(path("blank.txt"), false, true, 4), big), "text with blank lines, frames, mapped, 4 threads");
+
+  check_parser();
+  check_allocations(path("small.txt"), path("small.bin"));
+
+  remove_all();
+  std::cout << checks << " checks, " << failures << " failed" << std::endl;
+  return failures ? 1 : 0;
+}
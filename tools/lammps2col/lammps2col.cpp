@@ -0,0 +1,89 @@
+/*lammps2col.cpp
+  Converts a LAMMPS dump file into a columnar trajectory, which ColumnarReader can read
+  Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+  This program contains no LAMMPS source code.
+  More LAMMPS information may be found at http://lammps.sandia.gov
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <columnar.h>
+#include <lammpsreader.h>
+
+using namespace LAMMPSReaderNS;
+
+static void usage() {
+  std::cerr << "Usage: lammps2col [-b \"binary columns\"] [-n] <dump file> <output file> \"properties\"" << std::endl;
+  std::cerr << "  -b  the dump file is binary, and has these columns (all of them, in order)" << std::endl;
+  std::cerr << "  -n  don't wrap positions back into the box" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  bool binary= false;
+  bool wrap= true;
+  std::string layout;
+  int arg= 1;
+  while(arg < argc && argv[arg][0] == '-') {
+    if(strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) {
+      binary= true;
+      layout= argv[arg+1];
+      arg+= 2;
+    } else if(strcmp(argv[arg], "-n") == 0) {
+      wrap= false;
+      arg++;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if(argc - arg != 3) {
+    usage();
+    return 1;
+  }
+  std::string input= argv[arg];
+  std::string output= argv[arg+1];
+  std::string properties= argv[arg+2];
+
+  LAMMPSReader reader;
+  reader.wrap= wrap;
+  //the conversion reads straight through, so let the disk work while the frames are converted
+  if(!reader.open(input, binary) || !reader.EnablePrefetch()) {
+    return 1;
+  }
+  if(binary) {
+    reader.SetBinaryColumns(layout);
+  }
+  ColumnarWriter writer;
+  if(!writer.open(output, properties)) {
+    return 1;
+  }
+  Frame frame;
+  size_t frames= 0;
+  while(reader.ReadFrame(properties, frame)) {
+    if(!writer.WriteFrame(frame)) {
+      return 1;
+    }
+    frames++;
+  }
+  if(!writer.close()) {
+    return 1;
+  }
+  std::cout << "Wrote " << frames << " frames to " << output << std::endl;
+  return 0;
+}
@@ -0,0 +1,113 @@
+/*lammpsinfo.cpp
+  Summarises a LAMMPS dump file from its frame headers, without reading any atoms
+  Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+  This program contains no LAMMPS source code.
+  More LAMMPS information may be found at http://lammps.sandia.gov
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <lammpsreader.h>
+
+using namespace LAMMPSReaderNS;
+
+static void usage() {
+  std::cerr << "Usage: lammpsinfo [-b] [-t] [-n] <dump file>" << std::endl;
+  std::cerr << "  -b  the dump file is binary" << std::endl;
+  std::cerr << "  -t  print the header of every frame, as well as the summary" << std::endl;
+  std::cerr << "  -n  neither use nor save a .lrindex file" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  bool binary= false;
+  bool table= false;
+  bool sidecar= true;
+  int arg= 1;
+  while(arg < argc && argv[arg][0] == '-') {
+    if(strcmp(argv[arg], "-b") == 0) {
+      binary= true;
+    } else if(strcmp(argv[arg], "-t") == 0) {
+      table= true;
+    } else if(strcmp(argv[arg], "-n") == 0) {
+      sidecar= false;
+    } else {
+      usage();
+      return 1;
+    }
+    arg++;
+  }
+  if(argc - arg != 1) {
+    usage();
+    return 1;
+  }
+
+  LAMMPSReader reader;
+  std::vector<FrameInfo> frames;
+  if(!reader.open(argv[arg], binary) || !reader.ScanHeaders(frames, sidecar)) {
+    return 1;
+  }
+  if(table) {
+    printf("%-8s %14s %12s %14s  %s\n", "frame", "timestep", "atoms", "offset", "box");
+    for(size_t i= 0; i < frames.size(); i++) {
+      const FrameInfo& fi= frames[i];
+      printf("%-8zu %14lld %12lld %14lld  %c%c %c%c %c%c  %g %g  %g %g  %g %g\n", i,
+	     static_cast<long long>(fi.timestep), static_cast<long long>(fi.n_atoms), static_cast<long long>(fi.offset),
+	     fi.boundaries[0][0], fi.boundaries[0][1], fi.boundaries[1][0], fi.boundaries[1][1], fi.boundaries[2][0], fi.boundaries[2][1],
+	     fi.box_lo[0], fi.box_hi[0], fi.box_lo[1], fi.box_hi[1], fi.box_lo[2], fi.box_hi[2]);
+    }
+  }
+  printf("frames     %zu\n", frames.size());
+  if(frames.empty()) {
+    return 0;
+  }
+  int64_t min_atoms= frames[0].n_atoms, max_atoms= frames[0].n_atoms;
+  double lo_min[3], lo_max[3], hi_min[3], hi_max[3];
+  for(int d= 0; d < 3; d++) {
+    lo_min[d]= lo_max[d]= frames[0].box_lo[d];
+    hi_min[d]= hi_max[d]= frames[0].box_hi[d];
+  }
+  //the timesteps are evenly spaced if every gap is the same as the first
+  bool even= true;
+  for(size_t i= 1; i < frames.size(); i++) {
+    const FrameInfo& fi= frames[i];
+    min_atoms= std::min(min_atoms, fi.n_atoms);
+    max_atoms= std::max(max_atoms, fi.n_atoms);
+    for(int d= 0; d < 3; d++) {
+      lo_min[d]= std::min(lo_min[d], fi.box_lo[d]);
+      lo_max[d]= std::max(lo_max[d], fi.box_lo[d]);
+      hi_min[d]= std::min(hi_min[d], fi.box_hi[d]);
+      hi_max[d]= std::max(hi_max[d], fi.box_hi[d]);
+    }
+    even= even && (fi.timestep - frames[i-1].timestep == frames[1].timestep - frames[0].timestep);
+  }
+  printf("timesteps  %lld to %lld", static_cast<long long>(frames.front().timestep), static_cast<long long>(frames.back().timestep));
+  if(frames.size() > 1 && even) {
+    printf(", every %lld", static_cast<long long>(frames[1].timestep - frames[0].timestep));
+  }
+  printf("\natoms      %lld to %lld\n", static_cast<long long>(min_atoms), static_cast<long long>(max_atoms));
+  const char *dims= "xyz";
+  for(int d= 0; d < 3; d++) {
+    printf("box %c      lo %g to %g, hi %g to %g (%c%c)\n", dims[d], lo_min[d], lo_max[d], hi_min[d], hi_max[d],
+	   frames[0].boundaries[d][0], frames[0].boundaries[d][1]);
+  }
+  return 0;
+}
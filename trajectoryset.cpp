@@ -0,0 +1,282 @@
+/*
+    trajectoryset.cpp
+    TrajectorySet reads many LAMMPS dump files as one trajectory, on several threads
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glob.h>
+
+#include "trajectoryset.h"
+
+namespace LAMMPSReaderNS {
+
+  TrajectorySet::TrajectorySet(int threads, size_t d) {
+    wrap= true;
+    id_order= false;
+    use_sidecar= false;
+    nthreads= threads;
+    if(nthreads <= 0) {
+      nthreads= std::thread::hardware_concurrency();
+    }
+    if(nthreads <= 0) {
+      nthreads= 1;
+    }
+    depth= (d > 0) ? d : 2*nthreads;
+    binary= false;
+    mapped= false;
+    next_job= 0;
+    next_seq= 0;
+    failed= false;
+    stopping= false;
+  }
+
+  TrajectorySet::~TrajectorySet() {
+    close();
+  }
+
+  bool TrajectorySet::open(const std::string& pattern, bool bin, bool map) {
+    glob_t g;
+    int status= glob(pattern.c_str(), 0, NULL, &g);
+    if(status != 0) {
+      if(status == GLOB_NOMATCH) {
+	std::cerr << "ERROR: No files match " << pattern << std::endl;
+      } else {
+	std::cerr << "ERROR: Failed to list the files matching " << pattern << std::endl;
+      }
+      globfree(&g);
+      return false;
+    }
+    //glob sorts the names, which decides the order of files starting on the same timestep
+    std::vector<std::string> names(g.gl_pathv, g.gl_pathv + g.gl_pathc);
+    globfree(&g);
+    return open(names, bin, map);
+  }
+
+  bool TrajectorySet::open(const std::vector<std::string>& names, bool bin, bool map) {
+    close();
+    binary= bin;
+    mapped= map;
+    if(!indexFiles(names)) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  bool TrajectorySet::indexFiles(const std::vector<std::string>& names) {
+    //the files are opened and indexed several at a time, which hides the
+    //latency of opening them on a slow filesystem as well as the scanning
+    std::vector<std::vector<FrameInfo> > tables(names.size());
+    std::vector<char> ok(names.size(), 1);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for(int t= 0; t < nthreads; t++) {
+      pool.push_back(std::thread([&]() {
+	size_t i;
+	while((i= next++) < names.size()) {
+	  LAMMPSReader r;
+	  if(!r.open(names[i], binary) || !r.BuildIndex(use_sidecar)) {
+	    ok[i]= 0;
+	    continue;
+	  }
+	  tables[i]= r.Index();
+	}
+      }));
+    }
+    for(std::vector<std::thread>::iterator it= pool.begin(); it < pool.end(); it++) {
+      it->join();
+    }
+    for(size_t i= 0; i < names.size(); i++) {
+      if(!ok[i]) {
+	std::cerr << "ERROR: Failed to index " << names[i] << ", so the trajectory can't be read." << std::endl;
+	return false;
+      }
+    }
+
+    //files which hold no frames are left out
+    std::vector<size_t> order;
+    for(size_t i= 0; i < names.size(); i++) {
+      if(!tables[i].empty()) {
+	order.push_back(i);
+      }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return tables[a][0].timestep < tables[b][0].timestep;
+    });
+
+    for(std::vector<size_t>::iterator it= order.begin(); it < order.end(); it++) {
+      const std::vector<FrameInfo>& table= tables[*it];
+      for(std::vector<FrameInfo>::const_iterator fi= table.begin(); fi < table.end(); fi++) {
+	//a run restarted from an earlier timestep replaces whatever came before it from that
+	//timestep on, including the frame written again at the restart, whether the restart
+	//went to a file of its own or was appended to the same one
+	while(!index.empty() && index.back().timestep >= fi->timestep) {
+	  index.pop_back();
+	  frame_file.pop_back();
+	}
+	index.push_back(*fi);
+	frame_file.push_back(files.size());
+      }
+      files.push_back(names[*it]);
+    }
+    return true;
+  }
+
+  void TrajectorySet::close() {
+    stop();
+    files.clear();
+    index.clear();
+    frame_file.clear();
+  }
+
+  void TrajectorySet::start(const std::string& s) {
+    properties= s;
+    next_job= 0;
+    next_seq= 0;
+    failed= false;
+    //the id_order rows handed out so far, which every frame is padded to
+    front.id_rows= 0;
+    stopping= false;
+    //depth frames are shared by all the workers, which bounds the memory in use
+    for(size_t i= 0; i < depth; i++) {
+      free_frames.push_back(new Frame());
+    }
+    for(int i= 0; i < nthreads; i++) {
+      threads.push_back(std::thread(&TrajectorySet::workLoop, this));
+    }
+  }
+
+  void TrajectorySet::stop() {
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      stopping= true;
+    }
+    cv.notify_all();
+    for(std::vector<std::thread>::iterator it= threads.begin(); it < threads.end(); it++) {
+      it->join();
+    }
+    threads.clear();
+    for(std::vector<Frame*>::iterator it= free_frames.begin(); it < free_frames.end(); it++) {
+      delete *it;
+    }
+    free_frames.clear();
+    for(std::map<size_t, Frame*>::iterator it= done.begin(); it != done.end(); it++) {
+      delete it->second;
+    }
+    done.clear();
+  }
+
+  void TrajectorySet::workLoop() {
+    //each worker keeps the file of its last frame open, since the next is often from the same file
+    LAMMPSReader r;
+    r.wrap= wrap;
+    r.id_order= id_order;
+    r.SetBinaryColumns(binary_columns);
+    size_t cur= files.size();
+    while(true) {
+      std::unique_lock<std::mutex> lk(mtx);
+      cv.wait(lk, [this] { return stopping || next_job >= index.size() || !free_frames.empty(); });
+      if(stopping || next_job >= index.size()) {
+	return;
+      }
+      size_t seq= next_job++;
+      Frame *f= free_frames.back();
+      free_frames.pop_back();
+      lk.unlock();
+
+      bool ok= true;
+      if(frame_file[seq] != cur) {
+	cur= frame_file[seq];
+	ok= r.open(files[cur], binary, mapped);
+      }
+      ok= ok && r.seekTo(index[seq].offset) && r.ReadFrame(properties, *f);
+      if(!ok) {
+	cur= files.size();
+      }
+
+      lk.lock();
+      if(!ok) {
+	//a NULL result tells the consumer that this frame couldn't be read
+	free_frames.push_back(f);
+	f= NULL;
+      }
+      done[seq]= f;
+      cv.notify_all();
+    }
+  }
+
+  bool TrajectorySet::ReadFrame(const std::string& s, Frame& out) {
+    if(files.empty()) {
+      std::cerr << "TrajectorySet::ReadFrame() called while no files are open." << std::endl;
+      return false;
+    }
+    if(threads.empty()) {
+      start(s);
+    } else if(s != properties) {
+      std::cerr << "ERROR: TrajectorySet::ReadFrame() was asked for '" << s << "', but it is already reading '" << properties << "'. Reopen the files to change the properties." << std::endl;
+      return false;
+    }
+    std::unique_lock<std::mutex> lk(mtx);
+    if(failed) {
+      return false;
+    }
+    cv.wait(lk, [this] { return done.count(next_seq) > 0 || next_seq >= index.size(); });
+    std::map<size_t, Frame*>::iterator it= done.find(next_seq);
+    if(it == done.end()) {
+      //no more frames
+      return false;
+    }
+    Frame *f= it->second;
+    done.erase(it);
+    if(!f) {
+      //the worker has already reported what went wrong
+      failed= true;
+      return false;
+    }
+    next_seq++;
+    //swapping hands the caller's old arrays back to the pool, to be reused
+    std::swap(out, *f);
+    free_frames.push_back(f);
+    if(id_order) {
+      front.fitIdRows(out);
+    }
+    cv.notify_all();
+    return true;
+  }
+
+  void TrajectorySet::SetBinaryColumns(const std::string& s) {
+    binary_columns= s;
+  }
+
+  bool TrajectorySet::ReadFrame(const std::string& s, Callback *c) {
+    if(!ReadFrame(s, current)) {
+      return false;
+    }
+    front.ReplayFrame(current, c);
+    return true;
+  }
+}
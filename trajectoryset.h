@@ -0,0 +1,102 @@
+/*
+    trajectoryset.h
+    TrajectorySet reads many LAMMPS dump files as one trajectory, on several threads
+    Copyright (C) 2013 Niall Jackson <niall.jackson@gmail.com>
+    This program contains no LAMMPS source code.
+    More LAMMPS information may be found at http://lammps.sandia.gov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef TRAJECTORYSET_H
+#define TRAJECTORYSET_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lammpsreader.h"
+
+namespace LAMMPSReaderNS {
+
+  //the files are indexed at the same time, put in order of their first timestep,
+  //and then a pool of workers parse their frames, which are handed back in order
+  //where a restarted run overlaps the one before it, the later file's frames are kept
+  class TrajectorySet {
+  public:
+    bool wrap;
+    bool id_order;
+    //as the argument to LAMMPSReader::BuildIndex(): reuse and save each file's .lrindex
+    bool use_sidecar;
+
+    //threads= 0 uses one worker per core, depth= 0 allows two frames in flight per worker
+    TrajectorySet(int threads= 0, size_t depth= 0);
+    ~TrajectorySet();
+
+    //a glob pattern, such as "dump.*.lammpstrj", or a list of files
+    bool open(const std::string& pattern, bool bin= false, bool map= false);
+    bool open(const std::vector<std::string>& files, bool bin= false, bool map= false);
+    void close();
+
+    //the properties must be the same for every call between open() and close()
+    bool ReadFrame(const std::string&, Frame&);
+    bool ReadFrame(const std::string&, Callback *c);
+    //as LAMMPSReader::SetBinaryColumns(), and must also be called before the first ReadFrame()
+    void SetBinaryColumns(const std::string&);
+    //whether ReadFrame() stopped because a frame couldn't be read, rather than after the last frame
+    bool error() const { return failed; }
+
+    //the files, in the order they're read
+    const std::vector<std::string>& Files() const { return files; }
+    //every frame that will be read, with offset being the offset in its own file
+    const std::vector<FrameInfo>& Index() const { return index; }
+  private:
+    int nthreads;
+    size_t depth;
+    bool binary;
+    bool mapped;
+    std::string properties;
+    std::string binary_columns;
+    std::vector<std::string> files;
+    std::vector<FrameInfo> index;
+    //the file each frame in index comes from
+    std::vector<size_t> frame_file;
+
+    LAMMPSReader front;
+    std::vector<std::thread> threads;
+    Frame current;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<Frame*> free_frames;
+    std::map<size_t, Frame*> done;
+    //the next frame to be given to a worker, and to the caller
+    size_t next_job;
+    size_t next_seq;
+    bool failed;
+    bool stopping;
+
+    bool indexFiles(const std::vector<std::string>&);
+    void start(const std::string&);
+    void stop();
+    void workLoop();
+  };
+}
+
+#endif